@@ -0,0 +1,303 @@
+/**
+ * @file Admission.c
+ * @brief Load shedding: how many connections are let in at once.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include "Admission.h"
+#include "Config.h"
+#include "Http.h"
+
+/* How often the adaptive limit moves, and how far each estimate looks back. */
+enum { ADAPT_INTERVAL_US = 100 * 1000, SHORT_SAMPLES = 10, LONG_SAMPLES = 500 };
+
+/* Latency may rise this much over the long-term average before the limit shrinks. */
+#define LATENCY_TOLERANCE 1.5
+
+/* Connections the adaptive limit starts at, per CPU. */
+enum { INITIAL_PER_CPU = 64 };
+
+/**
+ * @struct Admission
+ * @brief The shared state behind the limit.
+ */
+typedef struct Admission {
+	atomic_int inflight;       // admitted and not yet left
+	atomic_int limit;
+	pthread_mutex_t mutex;     // process-shared, guards what follows
+	double estimate;           // the limit, before rounding
+	double short_latency;      // us, averaged over ~SHORT_SAMPLES
+	double long_latency;       // us, averaged over ~LONG_SAMPLES
+	long adapted;              // us, when the limit last moved
+} Admission;
+
+static Admission* state;       // NULL when there is no limit
+static atomic_long* started;   // us, by file descriptor, this process's own; --adaptive-limit only
+static long started_count;
+static int floor_limit;
+static int ceiling_limit;
+
+// A descriptor kept in reserve, given up to accept() and shed the
+// next connection when there are none left
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int spare_fd = -1;
+
+static long now_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * @brief Allocate zeroed memory that forked children share with us.
+ */
+static void* shared_alloc(size_t size) {
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+int admission_init(void) {
+	spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	if(config.max_conns == 0 && !config.adaptive_limit) {
+		return 0;
+	}
+
+	struct rlimit files;
+	if(getrlimit(RLIMIT_NOFILE, &files) < 0) {
+		return -1;
+	}
+	long count = files.rlim_cur == RLIM_INFINITY || files.rlim_cur > 1 << 22 ? 1 << 22 : (long)files.rlim_cur;
+
+	Admission* s = shared_alloc(sizeof(Admission));
+	if(s == NULL) {
+		return -1;
+	}
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&s->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	ceiling_limit = config.max_conns > 0 ? config.max_conns : (int)count;
+	int limit = ceiling_limit;
+	if(config.adaptive_limit) {
+		//Not shared: --model=proc's parent reuses a descriptor number as
+		//soon as it has forked, while the child still needs the start
+		//time it was accepted with, which its copy keeps. Untouched
+		//pages of it cost nothing.
+		started = calloc(count, sizeof(atomic_long));
+		if(started == NULL) {
+			return -1;
+		}
+		started_count = count;
+		//Never so low that workers sit idle
+		floor_limit = config.workers > 4 ? config.workers : 4;
+		if(floor_limit > ceiling_limit) {
+			floor_limit = ceiling_limit;
+		}
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		long initial = (cpus > 0 ? cpus : 4) * INITIAL_PER_CPU;
+		if(initial < limit) {
+			limit = initial < floor_limit ? floor_limit : (int)initial;
+		}
+	}
+	s->estimate = limit;
+	atomic_store(&s->limit, limit);
+	state = s;
+	return 0;
+}
+
+/**
+ * @brief Answer a connection with a 503 and close it.
+ *
+ * Whatever request has already arrived is read first, since closing
+ * with unread data would reset the connection, 503 and all.
+ */
+static void reject(int connfd) {
+	char discard[4096];
+	send_unavailable(connfd);
+	while(recv(connfd, discard, sizeof(discard), MSG_DONTWAIT) > 0)
+		/* discard */;
+	close(connfd);
+}
+
+/**
+ * @brief Out of descriptors: give up the spare one to shed a connection.
+ *
+ * Otherwise the pending connection would stay at the head of the
+ * backlog, and a level-triggered poll of the listening socket would
+ * spin on it. accept() fails like this whether or not one is pending,
+ * so check first.
+ *
+ * @return 1 if a connection was shed, 0 if none was pending.
+ */
+static int shed_without_descriptor(int sfd) {
+	static long last_warning;
+	long now = now_us();
+	if(now - last_warning > 1000000) {
+		last_warning = now;
+		perror("Accept failed, shedding load");
+	}
+
+	struct pollfd pending = { .fd = sfd, .events = POLLIN };
+	if(poll(&pending, 1, 0) <= 0) {
+		return 0;
+	}
+	pthread_mutex_lock(&spare_mutex);
+	int had_spare = spare_fd >= 0;
+	if(had_spare) {
+		close(spare_fd);
+		int connfd = accept4(sfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(connfd >= 0) {
+			reject(connfd);
+		}
+		spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+	pthread_mutex_unlock(&spare_mutex);
+	if(!had_spare) {
+		//No spare either, so all we can do is let some close
+		poll(NULL, 0, 10);
+	}
+	return 1;
+}
+
+int admission_accept(int sfd, int flags) {
+	for(;;) {
+		//accept() blocks until a client connects (unless sfd doesn't).
+		int connfd = accept4(sfd, NULL, NULL, flags);
+		if(connfd < 0) {
+			switch(errno) {
+			case EMFILE:
+			case ENFILE:
+				if(shed_without_descriptor(sfd) == 0) {
+					if(fcntl(sfd, F_GETFL) & O_NONBLOCK) {
+						errno = EAGAIN;
+						return -1;
+					}
+					//nobody to shed, wait for a descriptor or a client
+					poll(NULL, 0, 10);
+				}
+				continue;
+			case ENOBUFS:
+			case ENOMEM:
+				//the kernel is short, give it a moment
+				poll(NULL, 0, 10);
+				continue;
+			case EBADF:
+			case EFAULT:
+			case EINVAL:
+			case ENOTSOCK:
+			case EOPNOTSUPP:
+			case EAGAIN:
+				return -1;
+			default:
+				//EINTR, ECONNABORTED, EPERM, and the network errors
+				//accept() passes on from the new connection
+				continue;
+			}
+		}
+		if(state == NULL) {
+			return connfd;
+		}
+
+		int limit = atomic_load_explicit(&state->limit, memory_order_relaxed);
+		if(atomic_fetch_add_explicit(&state->inflight, 1, memory_order_relaxed) >= limit) {
+			atomic_fetch_sub_explicit(&state->inflight, 1, memory_order_relaxed);
+			reject(connfd);
+			continue;
+		}
+		if(started != NULL && connfd < started_count) {
+			atomic_store_explicit(&started[connfd], now_us(), memory_order_relaxed);
+		}
+		return connfd;
+	}
+}
+
+/**
+ * @brief Integer square root, near enough for a queue allowance.
+ */
+static int root(int n) {
+	int r = 1;
+	while((r + 1) * (r + 1) <= n) {
+		r++;
+	}
+	return r;
+}
+
+/**
+ * @brief Feed a connection's latency to the adaptive limit.
+ */
+static void adapt(long latency) {
+	//Whoever has the lock is updating already; a sample more or
+	//less doesn't matter, holding up a worker would
+	if(pthread_mutex_trylock(&state->mutex) != 0) {
+		return;
+	}
+	if(latency < 1) {
+		latency = 1;
+	}
+	if(state->long_latency == 0) {
+		state->short_latency = latency;
+		state->long_latency = latency;
+	}
+	state->short_latency += (latency - state->short_latency) / SHORT_SAMPLES;
+	state->long_latency += (latency - state->long_latency) / LONG_SAMPLES;
+	//After a spell of overload, drop the long-term average back
+	//quickly instead of taking the slow latency as the new normal
+	if(state->long_latency > 2 * state->short_latency) {
+		state->long_latency *= 0.95;
+	}
+
+	long now = now_us();
+	if(now - state->adapted >= ADAPT_INTERVAL_US) {
+		state->adapted = now;
+		double gradient = LATENCY_TOLERANCE * state->long_latency / state->short_latency;
+		gradient = gradient < 0.5 ? 0.5 : gradient > 1.0 ? 1.0 : gradient;
+		double limit = state->estimate;
+		double next = limit * gradient + root((int)limit);
+		//Only grow when we are near the limit, or a quiet spell would
+		//raise it without ever testing it
+		if(next > limit && atomic_load_explicit(&state->inflight, memory_order_relaxed) < limit / 2) {
+			next = limit;
+		}
+		limit = 0.8 * limit + 0.2 * next;
+		limit = limit < floor_limit ? floor_limit : limit > ceiling_limit ? ceiling_limit : limit;
+		state->estimate = limit;
+		atomic_store_explicit(&state->limit, (int)limit, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&state->mutex);
+}
+
+void admission_leave(int connfd) {
+	if(state == NULL) {
+		return;
+	}
+	atomic_fetch_sub_explicit(&state->inflight, 1, memory_order_relaxed);
+	if(started != NULL && connfd >= 0 && connfd < started_count) {
+		adapt(now_us() - atomic_load_explicit(&started[connfd], memory_order_relaxed));
+	}
+}
+
+void admission_turn_away(int connfd) {
+	if(state != NULL) {
+		atomic_fetch_sub_explicit(&state->inflight, 1, memory_order_relaxed);
+	}
+	reject(connfd);
+}
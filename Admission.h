@@ -0,0 +1,65 @@
+/**
+ * @file Admission.h
+ * @brief Load shedding: how many connections are let in at once.
+ *
+ * Every model accepts through admission_accept(). A connection over
+ * the limit is answered with a 503 straight away, before its request
+ * is read, which costs the acceptor next to nothing; one that is let
+ * in counts against the limit until admission_leave() just before it
+ * is closed.
+ *
+ * The limit is --max-conns, or with --adaptive-limit it floats below
+ * that with the latency of recent connections (accept to close): a
+ * gradient limiter compares a short-term average with a long-term
+ * one, and shrinks the limit in proportion as the short one rises,
+ * or grows it by about its square root while latency holds steady.
+ *
+ * Running out of descriptors (EMFILE, ENFILE) sheds the next pending
+ * connection with a 503 instead of taking the server down.
+ *
+ * The counts live in shared memory, so that --model=proc's children
+ * can give their connection back. Each connection's start time is kept
+ * by descriptor in memory of the process's own, which a child inherits
+ * as it was when it was forked.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+/**
+ * @brief Set up the limit from config. Must be called before any fork().
+ *
+ * @return 0 on success, -1 on error.
+ */
+int admission_init(void);
+
+/**
+ * @brief accept() the next connection that is let in.
+ *
+ * Connections over the limit, and those that can't be given a
+ * descriptor, get a 503 and are closed along the way.
+ *
+ * @param sfd The listening socket.
+ * @param flags For accept4(), e.g. SOCK_NONBLOCK.
+ * @return The client socket, or -1 with errno set: EAGAIN if sfd is
+ *         non-blocking and nothing is pending, anything else is fatal.
+ */
+int admission_accept(int sfd, int flags);
+
+/**
+ * @brief Close an admitted connection with a 503 after all.
+ *
+ * For when there is nowhere to put it: a full queue, a failed fork().
+ * It is not counted as a latency sample.
+ */
+void admission_turn_away(int connfd);
+
+/**
+ * @brief Give back an admitted connection's place. Call before closing it.
+ */
+void admission_leave(int connfd);
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @file Arena.c
+ * @brief A bump allocator for data that lives as long as one connection.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdlib.h>
+#include "Arena.h"
+
+enum { ARENA_ALIGN = 16 };
+
+static size_t align_up(size_t n) {
+	return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(Arena* arena, size_t block_size) {
+	arena->head = NULL;
+	arena->block_size = block_size;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+	size = align_up(size);
+	ArenaBlock* block = arena->head;
+	if(block == NULL || block->size - block->used < size) {
+		size_t want = size > arena->block_size ? size : arena->block_size;
+		block = malloc(sizeof(ArenaBlock) + want);
+		if(block == NULL) {
+			return NULL;
+		}
+		block->size = want;
+		block->used = 0;
+		block->next = arena->head;
+		arena->head = block;
+	}
+	void* p = block->data + block->used;
+	block->used += size;
+	return p;
+}
+
+void arena_reset(Arena* arena) {
+	// Keep the largest block: it is the one that fit the biggest
+	// connection, so it is the most likely to fit the next one.
+	ArenaBlock* keep = NULL;
+	ArenaBlock* block = arena->head;
+	while(block != NULL) {
+		ArenaBlock* next = block->next;
+		if(keep == NULL || block->size > keep->size) {
+			free(keep);
+			keep = block;
+		} else {
+			free(block);
+		}
+		block = next;
+	}
+	if(keep != NULL) {
+		keep->used = 0;
+		keep->next = NULL;
+	}
+	arena->head = keep;
+}
+
+void arena_destroy(Arena* arena) {
+	ArenaBlock* block = arena->head;
+	while(block != NULL) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file Arena.h
+ * @brief A bump allocator for data that lives as long as one connection.
+ *
+ * Allocation is a pointer increment; nothing is freed individually.
+ * arena_reset() throws everything away at once and keeps the first
+ * block around for the next connection, so a worker that serves many
+ * connections stops calling malloc() for its buffers altogether.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t size;
+	size_t used;
+	_Alignas(16) char data[]; // keeps the first allocation aligned too
+} ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock* head;  // the block being allocated from
+	size_t block_size; // size of new blocks, unless a request is bigger
+} Arena;
+
+void arena_init(Arena* arena, size_t block_size);
+
+/**
+ * @brief Allocate size bytes, aligned for any type.
+ *
+ * @return The memory, or NULL if a new block could not be allocated.
+ */
+void* arena_alloc(Arena* arena, size_t size);
+
+/**
+ * @brief Free everything allocated so far, keeping one block for reuse.
+ */
+void arena_reset(Arena* arena);
+
+void arena_destroy(Arena* arena);
+
+#endif
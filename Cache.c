@@ -0,0 +1,407 @@
+/**
+ * @file Cache.c
+ * @brief The cache backends behind Cache.h.
+ *
+ * The deque and sharded backends share one implementation: a deque
+ * cache is simply a sharded cache with a single shard.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "Cache.h"
+#include "Deque.h"
+#include "PriorityQueue.h"
+#include "Numa.h"
+
+/* Hits from another node it takes for an entry to be copied to that node,
+ * and the largest body that is copied: the copy is made by the hit. */
+enum { REPLICATE_AFTER_HITS = 8, REPLICATE_MAX_BYTES = 64 * 1024 };
+
+/* Miss counters for --admit-after, and how many misses between halving them all. */
+enum { ADMIT_SLOTS = 4096, ADMIT_AGE_AFTER = 8 * ADMIT_SLOTS };
+
+/**
+ * @struct Shard
+ * @brief One independently locked piece of a deque cache.
+ */
+typedef struct Shard {
+	pthread_mutex_t mutex;
+	Deque deck;
+} Shard;
+
+struct Cache {
+	CacheBackend backend;
+
+	// pq
+	pthread_mutex_t pq_mutex;
+	PriorityQueue* pq;
+
+	// deque, sharded
+	int shard_count;
+	Shard* shards;
+
+	// deque, sharded: with --numa-replicas, an LRU deque per NUMA node
+	// of copies of the entries that node keeps hitting, or NULL
+	Shard* replicas;
+	atomic_ulong generation;   // bumped by every invalidation
+
+	long object_max;           // largest body that is ever cached, 0 = any
+	// With --admit-after: misses of files of --admit-size or more, by a
+	// hash of the filename; colliding files share a counter
+	atomic_uchar* misses;
+	long admit_size;
+	int admit_after;
+	atomic_long missed;        // counted since the counters were last halved
+};
+
+static Shard* shard_for(Cache* cache, unsigned long hash) {
+	if(cache->shard_count == 1) {
+		return &cache->shards[0];
+	}
+	return &cache->shards[hash % cache->shard_count];
+}
+
+/**
+ * @brief The largest body worth reading into the cache.
+ *
+ * @param store_bytes The byte limit of each deque or the PriorityQueue,
+ *                    which would turn away anything larger anyway.
+ * @return The limit, 0 for none.
+ */
+static long object_max(const Config* config, long store_bytes) {
+	long max = config->cache_max_object;
+	if(store_bytes > 0 && (max == 0 || store_bytes < max)) {
+		max = store_bytes;
+	}
+	return max;
+}
+
+Cache* cache_create(const Config* config) {
+	if(config->cache == CACHE_NONE) {
+		return NULL;
+	}
+
+	Cache* cache = calloc(1, sizeof(Cache));
+	if(cache == NULL) {
+		return NULL;
+	}
+	cache->backend = config->cache;
+	int lru = config->eviction == EVICT_LRU;
+
+	if(config->admit_after > 1) {
+		cache->misses = calloc(ADMIT_SLOTS, sizeof(atomic_uchar));
+		if(cache->misses == NULL) {
+			free(cache);
+			return NULL;
+		}
+		cache->admit_size = config->admit_size;
+		cache->admit_after = config->admit_after;
+	}
+
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_init(&cache->pq_mutex, NULL);
+		cache->pq = create_priority_queue(config->cache_entries, config->cache_bytes, lru);
+		if(cache->pq == NULL) {
+			free(cache->misses);
+			free(cache);
+			return NULL;
+		}
+		cache->object_max = object_max(config, config->cache_bytes);
+		return cache;
+	}
+
+	// Split the limits evenly, rounding up so that a small cache
+	// still gets at least one entry per shard.
+	cache->shard_count = cache->backend == CACHE_SHARDED ? config->cache_shards : 1;
+	cache->shards = malloc(cache->shard_count * sizeof(Shard));
+	if(cache->shards == NULL) {
+		free(cache->misses);
+		free(cache);
+		return NULL;
+	}
+	int entries = (config->cache_entries + cache->shard_count - 1) / cache->shard_count;
+	long bytes = (config->cache_bytes + cache->shard_count - 1) / cache->shard_count;
+	cache->object_max = object_max(config, bytes);
+	for(int i = 0; i < cache->shard_count; i++) {
+		pthread_mutex_init(&cache->shards[i].mutex, NULL);
+		deque_init(&cache->shards[i].deck, entries, bytes, lru);
+	}
+
+	if(config->numa_replicas > 0 && numa_nodes() > 1) {
+		cache->replicas = malloc(numa_nodes() * sizeof(Shard));
+		if(cache->replicas == NULL) {
+			free(cache->shards);
+			free(cache->misses);
+			free(cache);
+			return NULL;
+		}
+		for(int i = 0; i < numa_nodes(); i++) {
+			pthread_mutex_init(&cache->replicas[i].mutex, NULL);
+			deque_init(&cache->replicas[i].deck, config->numa_replicas, config->cache_bytes, 1);
+		}
+	}
+	return cache;
+}
+
+/**
+ * @brief Count a hit on an entry from another node, copying it there once hot.
+ *
+ * @param generation cache->generation from before resp was looked up;
+ *                   if it has moved on, resp may be stale.
+ */
+static void replicate(Cache* cache, HttpResponse* resp, int node, unsigned long generation) {
+	if((atomic_fetch_add_explicit(&resp->remote_hits, 1, memory_order_relaxed) + 1) % REPLICATE_AFTER_HITS != 0) {
+		return;
+	}
+	HttpResponse* copy = copy_http_response(resp);
+	if(copy == NULL) {
+		return;
+	}
+	Shard* local = &cache->replicas[node];
+	pthread_mutex_lock(&local->mutex);
+	HttpResponse* existing = deque_search(&local->deck, http_response_key(copy), copy->hash, copy->encoding);
+	if(existing != NULL) {
+		put_down(existing);
+	} else if(atomic_load(&cache->generation) == generation) {
+		deque_enqueue(&local->deck, copy);
+	}
+	pthread_mutex_unlock(&local->mutex);
+	put_down(copy);
+}
+
+HttpResponse* cache_lookup(Cache* cache, const char* filename, ContentEncoding encoding) {
+	HttpResponse* found;
+	unsigned long hash = http_response_hash(filename);
+
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_lock(&cache->pq_mutex);
+		found = search(cache->pq, filename, hash, encoding);
+		if(found == NULL) {
+			pthread_mutex_unlock(&cache->pq_mutex);
+		}
+		/**
+		 * Notice that on a hit the mutex is not unlocked until
+		 * the response is released.
+		 */
+		return found;
+	}
+
+	int node = 0;
+	unsigned long generation = 0;
+	if(cache->replicas != NULL) {
+		node = numa_node();
+		Shard* local = &cache->replicas[node];
+		pthread_mutex_lock(&local->mutex);
+		found = deque_search(&local->deck, filename, hash, encoding);
+		pthread_mutex_unlock(&local->mutex);
+		if(found != NULL) {
+			return found;
+		}
+		generation = atomic_load(&cache->generation);
+	}
+
+	Shard* shard = shard_for(cache, hash);
+	pthread_mutex_lock(&shard->mutex);
+	found = deque_search(&shard->deck, filename, hash, encoding);
+	pthread_mutex_unlock(&shard->mutex);
+	if(found != NULL && cache->replicas != NULL && found->node != node
+	   && found->filesize <= REPLICATE_MAX_BYTES) {
+		replicate(cache, found, node, generation);
+	}
+	return found;
+}
+
+void cache_release(Cache* cache, HttpResponse* resp) {
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_unlock(&cache->pq_mutex);
+		return;
+	}
+
+	// The reference count lives in the response, so unlike the old
+	// Node there is no need to take the shard's mutex again.
+	put_down(resp);
+}
+
+int cache_insert(Cache* cache, HttpResponse* resp) {
+	int cached;
+
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_lock(&cache->pq_mutex);
+		cached = enqueue(cache->pq, resp);
+		pthread_mutex_unlock(&cache->pq_mutex);
+		return cached;
+	}
+
+	Shard* shard = shard_for(cache, resp->hash);
+	pthread_mutex_lock(&shard->mutex);
+	cached = deque_enqueue(&shard->deck, resp);
+	pthread_mutex_unlock(&shard->mutex);
+	return cached;
+}
+
+int cache_fits(const Cache* cache, long size) {
+	return cache->object_max == 0 || size <= cache->object_max;
+}
+
+int cache_admits(Cache* cache, const char* filename, long size) {
+	if(!cache_fits(cache, size)) {
+		return 0;
+	}
+	if(cache->misses == NULL || size < cache->admit_size) {
+		return 1;
+	}
+
+	//Halve every count now and then, so a file missed often long
+	//ago doesn't get in on one more miss
+	if(atomic_fetch_add_explicit(&cache->missed, 1, memory_order_relaxed) + 1 == ADMIT_AGE_AFTER) {
+		for(int i = 0; i < ADMIT_SLOTS; i++) {
+			atomic_store_explicit(&cache->misses[i],
+			                      atomic_load_explicit(&cache->misses[i], memory_order_relaxed) / 2,
+			                      memory_order_relaxed);
+		}
+		atomic_store_explicit(&cache->missed, 0, memory_order_relaxed);
+	}
+
+	atomic_uchar* count = &cache->misses[http_response_hash(filename) % ADMIT_SLOTS];
+	unsigned char seen = atomic_load_explicit(count, memory_order_relaxed);
+	if(seen + 1 >= cache->admit_after) {
+		//In now, and once evicted it has to earn its way back
+		atomic_store_explicit(count, 0, memory_order_relaxed);
+		return 1;
+	}
+	if(seen < 255) {
+		atomic_store_explicit(count, seen + 1, memory_order_relaxed);
+	}
+	return 0;
+}
+
+void cache_invalidate(Cache* cache, const char* filename) {
+	unsigned long hash = http_response_hash(filename);
+
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_lock(&cache->pq_mutex);
+		remove_file(cache->pq, filename, hash);
+		pthread_mutex_unlock(&cache->pq_mutex);
+		return;
+	}
+
+	// Before the originals go, so no copy of one is made after its
+	// replicas are gone
+	if(cache->replicas != NULL) {
+		atomic_fetch_add(&cache->generation, 1);
+	}
+
+	// Every encoding of the file hashes to the same shard.
+	Shard* shard = shard_for(cache, hash);
+	pthread_mutex_lock(&shard->mutex);
+	deque_invalidate(&shard->deck, filename, hash);
+	pthread_mutex_unlock(&shard->mutex);
+
+	for(int i = 0; cache->replicas != NULL && i < numa_nodes(); i++) {
+		pthread_mutex_lock(&cache->replicas[i].mutex);
+		deque_invalidate(&cache->replicas[i].deck, filename, hash);
+		pthread_mutex_unlock(&cache->replicas[i].mutex);
+	}
+}
+
+void cache_clear(Cache* cache) {
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_lock(&cache->pq_mutex);
+		remove_all(cache->pq);
+		pthread_mutex_unlock(&cache->pq_mutex);
+		return;
+	}
+
+	if(cache->replicas != NULL) {
+		atomic_fetch_add(&cache->generation, 1);
+	}
+	for(int i = 0; i < cache->shard_count; i++) {
+		pthread_mutex_lock(&cache->shards[i].mutex);
+		deque_clear(&cache->shards[i].deck);
+		pthread_mutex_unlock(&cache->shards[i].mutex);
+	}
+	for(int i = 0; cache->replicas != NULL && i < numa_nodes(); i++) {
+		pthread_mutex_lock(&cache->replicas[i].mutex);
+		deque_clear(&cache->replicas[i].deck);
+		pthread_mutex_unlock(&cache->replicas[i].mutex);
+	}
+}
+
+/**
+ * @brief Hand a snapshot of entries to fn, dropping the references it holds.
+ */
+static void visit_snapshot(HttpResponse** entries, int count,
+                           void (*fn)(HttpResponse* resp, void* arg), void* arg) {
+	for(int i = 0; i < count; i++) {
+		fn(entries[i], arg);
+		put_down(entries[i]);
+	}
+}
+
+void cache_for_each(Cache* cache, void (*fn)(HttpResponse* resp, void* arg), void* arg) {
+	// The entries are copied out under the lock and visited without it,
+	// so whatever fn does never holds up a lookup.
+	if(cache->backend == CACHE_PQ) {
+		pthread_mutex_lock(&cache->pq_mutex);
+		int count = cache->pq->size;
+		HttpResponse** entries = malloc((count + 1) * sizeof(HttpResponse*));
+		if(entries == NULL) {
+			pthread_mutex_unlock(&cache->pq_mutex);
+			return;
+		}
+		for(int i = 0; i < count; i++) {
+			entries[i] = cache->pq->items[i];
+			pick_up(entries[i]);
+		}
+		pthread_mutex_unlock(&cache->pq_mutex);
+		visit_snapshot(entries, count, fn, arg);
+		free(entries);
+		return;
+	}
+
+	for(int i = 0; i < cache->shard_count; i++) {
+		Shard* shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		int count = shard->deck.size;
+		HttpResponse** entries = malloc((count + 1) * sizeof(HttpResponse*));
+		if(entries == NULL) {
+			pthread_mutex_unlock(&shard->mutex);
+			continue;
+		}
+		int n = 0;
+		for(HttpResponse* curr = shard->deck.head; curr != NULL && n < count; curr = curr->next) {
+			entries[n++] = curr;
+			pick_up(curr);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+		visit_snapshot(entries, n, fn, arg);
+		free(entries);
+	}
+}
+
+/**
+ * @struct Revalidation
+ * @brief What cache_revalidate() passes through cache_for_each().
+ */
+typedef struct Revalidation {
+	Cache* cache;
+	int (*is_stale)(const HttpResponse*);
+} Revalidation;
+
+static void revalidate_entry(HttpResponse* resp, void* arg) {
+	Revalidation* r = arg;
+	if(r->is_stale(resp)) {
+		cache_invalidate(r->cache, http_response_key(resp));
+	}
+}
+
+void cache_revalidate(Cache* cache, int (*is_stale)(const HttpResponse*)) {
+	Revalidation r = { cache, is_stale };
+	cache_for_each(cache, revalidate_entry, &r);
+}
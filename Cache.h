@@ -0,0 +1,115 @@
+/**
+ * @file Cache.h
+ * @brief Pluggable response cache backends.
+ *
+ * Every backend hands out responses through cache_lookup() and takes
+ * them back through cache_release(). What happens in between depends
+ * on the backend:
+ *
+ *   none    never caches anything
+ *   deque   one reference-counted linked list behind one mutex;
+ *           the mutex is only held while searching
+ *   pq      the PriorityQueue behind one mutex, held for the whole
+ *           time a hit is being sent ("naive")
+ *   sharded several deques, each behind its own mutex, picked by
+ *           a hash of the filename
+ *
+ * On a NUMA machine, the deque and sharded backends can also keep
+ * --numa-replicas copies per node of the entries that node hits most,
+ * so hot bodies are read from local memory. cache_for_each() only
+ * visits the originals.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "HttpResponse.h"
+#include "Config.h"
+
+typedef struct Cache Cache;
+
+/**
+ * @brief Create the cache selected by config->cache.
+ *
+ * @return The cache, or NULL for `--cache=none` or on allocation failure.
+ */
+Cache* cache_create(const Config* config);
+
+/**
+ * @brief Look up a cached response.
+ *
+ * On a hit, the response must be passed back to cache_release() once
+ * it has been sent. It stays valid until then, even if it is evicted.
+ * Each encoding of a file is a separate entry.
+ *
+ * @return The response, or NULL on a miss.
+ */
+HttpResponse* cache_lookup(Cache* cache, const char* filename, ContentEncoding encoding);
+
+/**
+ * @brief Finish with a response returned by cache_lookup().
+ */
+void cache_release(Cache* cache, HttpResponse* resp);
+
+/**
+ * @brief Offer a freshly read response to the cache.
+ *
+ * The cache picks up its own reference; the caller still has to put
+ * down theirs.
+ *
+ * @return 1 if it was cached, 0 if not (e.g. it is too large).
+ */
+int cache_insert(Cache* cache, HttpResponse* resp);
+
+/**
+ * @brief Whether a body this large may be cached at all.
+ *
+ * Anything above --cache-max-object, or above what the cache could
+ * hold, is not worth reading into memory.
+ */
+int cache_fits(const Cache* cache, long size);
+
+/**
+ * @brief Decide whether a file missed in the cache should be read into it.
+ *
+ * Counts the miss. Files that don't fit never are; files smaller than
+ * --admit-size always are; the rest only on their --admit-after'th
+ * miss, so a big file requested once doesn't push out the hot ones.
+ *
+ * @return 1 to read it into the cache, 0 to stream it past.
+ */
+int cache_admits(Cache* cache, const char* filename, long size);
+
+/**
+ * @brief Drop every encoding of a file from the cache.
+ *
+ * Threads already sending it finish with the old copy.
+ */
+void cache_invalidate(Cache* cache, const char* filename);
+
+/**
+ * @brief Drop everything from the cache.
+ */
+void cache_clear(Cache* cache);
+
+/**
+ * @brief Call fn on every entry.
+ *
+ * fn is called without any cache lock held, holding a reference to the
+ * entry, so it is free to do I/O or to call back into the cache.
+ * Entries inserted meanwhile may be missed.
+ */
+void cache_for_each(Cache* cache, void (*fn)(HttpResponse* resp, void* arg), void* arg);
+
+/**
+ * @brief Check every entry and invalidate those whose file changed.
+ *
+ * is_stale() is called without any cache lock held, so it is free to
+ * stat() the file.
+ */
+void cache_revalidate(Cache* cache, int (*is_stale)(const HttpResponse* resp));
+
+#endif
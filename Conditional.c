@@ -0,0 +1,119 @@
+/**
+ * @file Conditional.c
+ * @brief Validators and conditional GET (RFC 7232).
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Conditional.h"
+#include "Request.h"
+
+int format_etag(char* out, size_t size, unsigned long ino, unsigned long filesize, time_t mtime,
+                const char* variant) {
+	if(variant != NULL) {
+		return snprintf(out, size, "\"%lx-%lx-%lx-%s\"", ino, filesize, (unsigned long)mtime, variant);
+	}
+	return snprintf(out, size, "\"%lx-%lx-%lx\"", ino, filesize, (unsigned long)mtime);
+}
+
+int format_http_date(char* out, size_t size, time_t t) {
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	return strftime(out, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+int parse_http_date(const char* s, size_t len, time_t* t) {
+	// IMF-fixdate, then the obsolete RFC 850 and asctime formats
+	static const char* formats[] = {
+		"%a, %d %b %Y %H:%M:%S GMT",
+		"%A, %d-%b-%y %H:%M:%S GMT",
+		"%a %b %e %H:%M:%S %Y",
+	};
+	char date[64];
+	struct tm tm;
+
+	if(len >= sizeof(date)) {
+		return -1;
+	}
+	memcpy(date, s, len);
+	date[len] = '\0';
+
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		memset(&tm, 0, sizeof(tm));
+		const char* end = strptime(date, formats[i], &tm);
+		if(end != NULL && *end == '\0') {
+			*t = timegm(&tm);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Does a comma separated list of entity tags contain etag?
+ *
+ * Uses weak comparison: a W/ prefix on either side is ignored.
+ */
+static int etag_list_matches(const char* list, size_t len, const char* etag) {
+	const char* end = list + len;
+	if(strncmp(etag, "W/", 2) == 0) {
+		etag += 2;
+	}
+	size_t etag_len = strlen(etag);
+
+	const char* p = list;
+	while(p < end) {
+		while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+			p++;
+		}
+		if(p == end) {
+			break;
+		}
+		if(*p == '*') {
+			return 1;
+		}
+		if(end - p >= 2 && p[0] == 'W' && p[1] == '/') {
+			p += 2;
+		}
+		//an entity tag is a quoted string, quotes included
+		const char* tag = p;
+		if(p < end && *p == '"') {
+			p++;
+			while(p < end && *p != '"') {
+				p++;
+			}
+			if(p < end) {
+				p++;
+			}
+		}
+		if((size_t)(p - tag) == etag_len && memcmp(tag, etag, etag_len) == 0) {
+			return 1;
+		}
+		//skip anything malformed up to the next comma
+		while(p < end && *p != ',') {
+			p++;
+		}
+	}
+	return 0;
+}
+
+int request_not_modified(const char* request, const char* etag, time_t mtime) {
+	size_t len;
+	const char* value = request_header(request, "If-None-Match", &len);
+	if(value != NULL) {
+		return etag_list_matches(value, len, etag);
+	}
+
+	value = request_header(request, "If-Modified-Since", &len);
+	time_t since;
+	//a date in the future can't have come from us, so ignore it
+	if(value != NULL && parse_http_date(value, len, &since) == 0 && since <= time(NULL)) {
+		return mtime <= since;
+	}
+	return 0;
+}
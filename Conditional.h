@@ -0,0 +1,71 @@
+/**
+ * @file Conditional.h
+ * @brief Validators and conditional GET (RFC 7232).
+ *
+ * Responses carry a strong ETag and a Last-Modified date, both made
+ * from the file's stat data, so they cost nothing to compute and stay
+ * the same across restarts. A request that presents a matching
+ * If-None-Match, or an If-Modified-Since that isn't older than the
+ * file, gets a 304 with no body.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * @brief Longest ETag format_etag() writes, with quotes and terminator.
+ */
+#define ETAG_SIZE 64
+
+/**
+ * @brief Longest date format_http_date() writes, with terminator.
+ */
+#define HTTP_DATE_SIZE 32
+
+/**
+ * @brief Write the strong ETag of a file, quotes included.
+ *
+ * @param variant Tells apart encodings of the same file, or NULL.
+ * @return The length written to out.
+ */
+int format_etag(char* out, size_t size, unsigned long ino, unsigned long filesize, time_t mtime,
+                const char* variant);
+
+/**
+ * @brief Write a time as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ * @return The length written to out.
+ */
+int format_http_date(char* out, size_t size, time_t t);
+
+/**
+ * @brief Parse an HTTP-date in any of the three formats RFC 7231 allows.
+ *
+ * @param s The date, not necessarily NUL-terminated.
+ * @param len The length of s.
+ * @param t Set to the parsed time.
+ * @return 0 on success, -1 if s is not a date.
+ */
+int parse_http_date(const char* s, size_t len, time_t* t);
+
+/**
+ * @brief Should this request get a 304?
+ *
+ * If-None-Match is checked with weak comparison, as the RFC requires
+ * for GET. If-Modified-Since is only checked when there is no
+ * If-None-Match.
+ *
+ * @param request The NUL-terminated request.
+ * @param etag The current ETag of the file.
+ * @param mtime The current modification time of the file.
+ * @return 1 if the client's copy is still good, 0 otherwise.
+ */
+int request_not_modified(const char* request, const char* etag, time_t mtime);
+
+#endif
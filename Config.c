@@ -0,0 +1,519 @@
+/**
+ * @file Config.c
+ * @brief Command-line and config-file option parsing.
+ *
+ * Both sources go through config_set(), so every option has exactly
+ * one name and one validation rule no matter where it comes from.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "Config.h"
+
+/**
+ * @struct Option
+ * @brief One entry of the option table, used for parsing and for usage().
+ */
+typedef struct Option {
+	const char* name;
+	const char* arg;
+	const char* help;
+} Option;
+
+static const Option options[] = {
+	{ "config",        "FILE",     "read settings from FILE (name = value per line)" },
+	{ "model",         "proc|thread|pool|epoll|steal|coro", "concurrency model" },
+	{ "cache",         "none|deque|pq|sharded",  "response cache backend" },
+	{ "port",          "PORT",     "port to listen on, 0 for ephemeral (default 80)" },
+	{ "bind",          "ADDR",     "IPv4 address to listen on (default 0.0.0.0)" },
+	{ "backlog",       "N",        "listen() backlog (default 10)" },
+	{ "workers",       "N",        "pool/epoll/steal: worker threads (default 2 per CPU); coro: reactor threads (default 1 per CPU); proc/thread: max concurrent connections (default unlimited)" },
+	{ "cache-entries", "N",        "max number of cached responses (default 5)" },
+	{ "cache-bytes",   "BYTES",    "max total size of cached bodies, 0 = unlimited (default 0)" },
+	{ "cache-shards",  "N",        "number of shards for --cache=sharded (default 16)" },
+	{ "cache-max-object", "BYTES", "stream larger files from disk instead of caching them, 0 = no limit (default 64M)" },
+	{ "admit-size",    "BYTES",    "files this large are only cached once missed --admit-after times (default 1M)" },
+	{ "admit-after",   "N",        "misses it takes for a file of --admit-size or more to be cached (default 1)" },
+	{ "eviction",      "fifo|lru", "cache eviction policy" },
+	{ "stats-log",     "FILE",     "per-request timing log" },
+	{ "docroot",       "DIR",      "directory to serve files from (default cwd)" },
+	{ "recv-buffer",   "BYTES",    "request buffer size (default 1024)" },
+	{ "io-buffer",     "BYTES",    "file read chunk size (default 1024)" },
+	{ "read-buffer",   "BYTES",    "read larger files this much at a time, into a page-aligned buffer (default 128K)" },
+	{ "disk-threads",  "N",        "threads that open and read files, so network threads never wait on disk, 0 = none (default 8)" },
+	{ "disk-queue-depth", "N",     "reads run at once per device by the disk threads, 0 = no limit (default 4)" },
+	{ "direct-io",     "BYTES",    "stream files this large with O_DIRECT when they aren't in the page cache, 0 = never (default 0)" },
+	{ "compress",      "on|off",   "compress text files once and cache the result (default on)" },
+	{ "compress-max",  "BYTES",    "largest file to compress on a miss (default 8M)" },
+	{ "watch",         "on|off",   "invalidate cached files when inotify sees them change (default on)" },
+	{ "revalidate",    "SECONDS",  "also stat() every cached file this often, 0 = never (default 10)" },
+	{ "warm-manifest", "FILE",     "preload the files listed in FILE, one per line" },
+	{ "warm-log",      "FILE",     "preload the most requested files in a stats log from an earlier run" },
+	{ "warm-top",      "N",        "preload at most N files (default --cache-entries)" },
+	{ "warm-threads",  "N",        "read this many files at once while preloading (default 4)" },
+	{ "warm-save",     "FILE",     "on SIGINT/SIGTERM, write the cached files to FILE for --warm-manifest" },
+	{ "neg-cache-entries", "N", "remember up to N missing paths, so repeat 404s skip the disk, 0 = off (default 1024)" },
+	{ "neg-cache-ttl", "SECONDS",  "how long a missing path is remembered (default 10)" },
+	{ "fd-cache-entries", "N",    "keep up to N recently served files open, 0 = off (default 256)" },
+	{ "steal-slice",   "BYTES",    "steal: body bytes sent before a worker moves on to other connections (default 256K)" },
+	{ "coro-stack",    "BYTES",    "coro: stack size of each connection's coroutine (default 128K)" },
+	{ "header-timeout", "SECONDS", "close connections that haven't sent their request by then, 0 = never (default 10)" },
+	{ "send-timeout",  "SECONDS",  "close connections whose response stalls this long, 0 = never (default 30)" },
+	{ "min-send-rate", "BYTES",    "close connections taking less than this a second on average, 0 = any (default 1K)" },
+	{ "max-conns",     "N",        "connections let in at once, queued or being served; more get a 503, 0 = no limit (default 0)" },
+	{ "adaptive-limit", "on|off",  "move the limit with measured latency, up to --max-conns (default off)" },
+	{ "queue-slots",   "N",        "pool/epoll/steal: connections waiting for a worker (default 4 per worker)" },
+	{ "queue-full",    "wait|reject", "pool/epoll/steal: stop accepting, or 503 new connections, while the queue is full (default wait)" },
+	{ "numa",          "on|off",   "spread workers over NUMA nodes, pinned, and keep cache entries on the node that made them (default on)" },
+	{ "numa-replicas", "N",        "deque/sharded: copy up to N entries of 64 KB or less hot on other nodes to each node, 0 = off (default 0)" },
+	{ "huge-pages",    "off|thp|hugetlb", "back cached responses with 2 MB pages, transparent or reserved (default off)" },
+	{ "zerocopy-min",  "BYTES",    "deque/sharded: send cached bodies this large without copying them, 0 = never (default 0)" },
+	{ "mime-types",    "FILE",     "extra MIME types, in mime.types format, overriding the built-in ones" },
+	{ "help",          NULL,       "show this message" },
+};
+
+static const char* model_names[] = { "proc", "thread", "pool", "epoll", "steal", "coro" };
+static const char* cache_names[] = { "none", "deque", "pq", "sharded" };
+
+enum { OPTION_COUNT = sizeof(options) / sizeof(options[0]) };
+
+/* Connections queued per pool worker, unless --queue-slots says otherwise. */
+enum { QUEUE_SLOTS_PER_WORKER = 4 };
+
+/* Buffers live on the worker's stack, so keep them well under its size. */
+enum { MIN_BUFFER_SIZE = 64, MAX_BUFFER_SIZE = 1024 * 1024 };
+
+Config config;
+
+const char* model_name(ConcurrencyModel model) {
+	return model_names[model];
+}
+
+const char* cache_name(CacheBackend cache) {
+	return cache_names[cache];
+}
+
+/**
+ * @brief Find `value` in a table of names.
+ *
+ * @return Its index, or -1.
+ */
+static int lookup_name(const char** names, int count, const char* value) {
+	for(int i = 0; i < count; i++) {
+		if(strcmp(names[i], value) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void config_init(Config* config, const char* stats_log) {
+	config->model = MODEL_THREAD;
+	config->cache = CACHE_NONE;
+	config->bind_address = strdup("0.0.0.0");
+	config->port = 80;
+	config->backlog = 10;
+	config->workers = 0;
+	config->cache_entries = 5;
+	config->cache_bytes = 0;
+	config->cache_shards = 16;
+	config->eviction = EVICT_FIFO;
+	config->cache_max_object = 64L * 1024 * 1024;
+	config->admit_size = 1024 * 1024;
+	config->admit_after = 1;
+	config->stats_log = strdup(stats_log);
+	config->docroot = NULL;
+	config->recv_buffer_size = 1024;
+	config->io_buffer_size = 1024;
+	config->read_buffer = 128 * 1024;
+	config->direct_io = 0;
+	config->disk_threads = 8;
+	config->disk_queue_depth = 4;
+	config->compress = 1;
+	config->compress_max = 8L * 1024 * 1024;
+	config->mime_types = NULL;
+	config->watch = 1;
+	config->warm_manifest = NULL;
+	config->warm_log = NULL;
+	config->warm_top = 0;
+	config->warm_threads = 4;
+	config->warm_save = NULL;
+	config->revalidate = 10;
+	config->neg_cache_entries = 1024;
+	config->neg_cache_ttl = 10;
+	config->fd_cache_entries = 256;
+	config->steal_slice = 256 * 1024;
+	config->coro_stack = 128 * 1024;
+	config->header_timeout = 10;
+	config->send_timeout = 30;
+	config->min_send_rate = 1024;
+	config->max_conns = 0;
+	config->adaptive_limit = 0;
+	config->queue_slots = 0;
+	config->queue_reject = 0;
+	config->numa = 1;
+	config->numa_replicas = 0;
+	config->huge_pages = HUGE_PAGES_OFF;
+	config->zerocopy_min = 0;
+}
+
+/**
+ * @brief Parse a non-negative integer with an optional K/M/G suffix.
+ *
+ * @return 0 on success, -1 if the value is malformed or above max.
+ */
+static int parse_size(const char* value, long max, long* out) {
+	char* end;
+	long multiplier = 1;
+	errno = 0;
+	long n = strtol(value, &end, 10);
+	if(end == value || n < 0 || errno == ERANGE) {
+		return -1;
+	}
+	switch(toupper((unsigned char)*end)) {
+	case 'K': multiplier = 1024L; end++; break;
+	case 'M': multiplier = 1024L * 1024; end++; break;
+	case 'G': multiplier = 1024L * 1024 * 1024; end++; break;
+	}
+	if(n > LONG_MAX / multiplier) {
+		return -1;
+	}
+	n *= multiplier;
+	if(*end != '\0' || n > max) {
+		return -1;
+	}
+	*out = n;
+	return 0;
+}
+
+int config_set(Config* config, const char* name, const char* value) {
+	long n;
+
+	if(strcmp(name, "model") == 0) {
+		int i = lookup_name(model_names, sizeof(model_names) / sizeof(model_names[0]), value);
+		if(i < 0) return -1;
+		config->model = (ConcurrencyModel)i;
+	} else if(strcmp(name, "cache") == 0) {
+		int i = lookup_name(cache_names, sizeof(cache_names) / sizeof(cache_names[0]), value);
+		if(i < 0) return -1;
+		config->cache = (CacheBackend)i;
+	} else if(strcmp(name, "port") == 0) {
+		if(parse_size(value, 65535, &n) < 0) return -1;
+		config->port = (int)n;
+	} else if(strcmp(name, "bind") == 0) {
+		struct in_addr tmp;
+		if(inet_pton(AF_INET, value, &tmp) != 1) return -1;
+		free(config->bind_address);
+		config->bind_address = strdup(value);
+	} else if(strcmp(name, "backlog") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0 || n == 0) return -1;
+		config->backlog = (int)n;
+	} else if(strcmp(name, "workers") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->workers = (int)n;
+	} else if(strcmp(name, "cache-entries") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0 || n == 0) return -1;
+		config->cache_entries = (int)n;
+	} else if(strcmp(name, "cache-shards") == 0) {
+		if(parse_size(value, 4096, &n) < 0 || n == 0) return -1;
+		config->cache_shards = (int)n;
+	} else if(strcmp(name, "cache-bytes") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->cache_bytes = n;
+	} else if(strcmp(name, "cache-max-object") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->cache_max_object = n;
+	} else if(strcmp(name, "admit-size") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->admit_size = n;
+	} else if(strcmp(name, "admit-after") == 0) {
+		//the misses are counted in a byte
+		if(parse_size(value, 255, &n) < 0 || n == 0) return -1;
+		config->admit_after = (int)n;
+	} else if(strcmp(name, "eviction") == 0) {
+		if(strcmp(value, "fifo") == 0) {
+			config->eviction = EVICT_FIFO;
+		} else if(strcmp(value, "lru") == 0) {
+			config->eviction = EVICT_LRU;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "stats-log") == 0) {
+		free(config->stats_log);
+		config->stats_log = strdup(value);
+	} else if(strcmp(name, "docroot") == 0) {
+		free(config->docroot);
+		config->docroot = strdup(value);
+	} else if(strcmp(name, "recv-buffer") == 0) {
+		if(parse_size(value, MAX_BUFFER_SIZE, &n) < 0 || n < MIN_BUFFER_SIZE) return -1;
+		config->recv_buffer_size = (int)n;
+	} else if(strcmp(name, "io-buffer") == 0) {
+		if(parse_size(value, MAX_BUFFER_SIZE, &n) < 0 || n < MIN_BUFFER_SIZE) return -1;
+		config->io_buffer_size = (int)n;
+	} else if(strcmp(name, "read-buffer") == 0) {
+		if(parse_size(value, MAX_BUFFER_SIZE, &n) < 0 || n < MIN_BUFFER_SIZE) return -1;
+		config->read_buffer = n;
+	} else if(strcmp(name, "disk-threads") == 0) {
+		if(parse_size(value, 1024, &n) < 0) return -1;
+		config->disk_threads = (int)n;
+	} else if(strcmp(name, "disk-queue-depth") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->disk_queue_depth = (int)n;
+	} else if(strcmp(name, "direct-io") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->direct_io = n;
+	} else if(strcmp(name, "compress") == 0) {
+		if(strcmp(value, "on") == 0) {
+			config->compress = 1;
+		} else if(strcmp(value, "off") == 0) {
+			config->compress = 0;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "compress-max") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->compress_max = n;
+	} else if(strcmp(name, "watch") == 0) {
+		if(strcmp(value, "on") == 0) {
+			config->watch = 1;
+		} else if(strcmp(value, "off") == 0) {
+			config->watch = 0;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "revalidate") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->revalidate = (int)n;
+	} else if(strcmp(name, "warm-manifest") == 0) {
+		free(config->warm_manifest);
+		config->warm_manifest = strdup(value);
+	} else if(strcmp(name, "warm-log") == 0) {
+		free(config->warm_log);
+		config->warm_log = strdup(value);
+	} else if(strcmp(name, "warm-top") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->warm_top = (int)n;
+	} else if(strcmp(name, "warm-threads") == 0) {
+		if(parse_size(value, 1024, &n) < 0 || n == 0) return -1;
+		config->warm_threads = (int)n;
+	} else if(strcmp(name, "warm-save") == 0) {
+		free(config->warm_save);
+		config->warm_save = strdup(value);
+	} else if(strcmp(name, "neg-cache-entries") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->neg_cache_entries = (int)n;
+	} else if(strcmp(name, "neg-cache-ttl") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->neg_cache_ttl = (int)n;
+	} else if(strcmp(name, "fd-cache-entries") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->fd_cache_entries = (int)n;
+	} else if(strcmp(name, "steal-slice") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0 || n == 0) return -1;
+		config->steal_slice = n;
+	} else if(strcmp(name, "coro-stack") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0 || n < 16 * 1024) return -1;
+		config->coro_stack = n;
+	} else if(strcmp(name, "header-timeout") == 0) {
+		if(parse_size(value, INT_MAX / 1000, &n) < 0) return -1;
+		config->header_timeout = (int)n;
+	} else if(strcmp(name, "send-timeout") == 0) {
+		if(parse_size(value, INT_MAX / 1000, &n) < 0) return -1;
+		config->send_timeout = (int)n;
+	} else if(strcmp(name, "min-send-rate") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->min_send_rate = n;
+	} else if(strcmp(name, "max-conns") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->max_conns = (int)n;
+	} else if(strcmp(name, "adaptive-limit") == 0) {
+		if(strcmp(value, "on") == 0) {
+			config->adaptive_limit = 1;
+		} else if(strcmp(value, "off") == 0) {
+			config->adaptive_limit = 0;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "queue-slots") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0 || n == 0) return -1;
+		config->queue_slots = (int)n;
+	} else if(strcmp(name, "queue-full") == 0) {
+		if(strcmp(value, "wait") == 0) {
+			config->queue_reject = 0;
+		} else if(strcmp(value, "reject") == 0) {
+			config->queue_reject = 1;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "numa") == 0) {
+		if(strcmp(value, "on") == 0) {
+			config->numa = 1;
+		} else if(strcmp(value, "off") == 0) {
+			config->numa = 0;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "numa-replicas") == 0) {
+		if(parse_size(value, INT_MAX, &n) < 0) return -1;
+		config->numa_replicas = (int)n;
+	} else if(strcmp(name, "huge-pages") == 0) {
+		if(strcmp(value, "off") == 0) {
+			config->huge_pages = HUGE_PAGES_OFF;
+		} else if(strcmp(value, "thp") == 0) {
+			config->huge_pages = HUGE_PAGES_THP;
+		} else if(strcmp(value, "hugetlb") == 0) {
+			config->huge_pages = HUGE_PAGES_HUGETLB;
+		} else {
+			return -1;
+		}
+	} else if(strcmp(name, "zerocopy-min") == 0) {
+		if(parse_size(value, LONG_MAX, &n) < 0) return -1;
+		config->zerocopy_min = n;
+	} else if(strcmp(name, "mime-types") == 0) {
+		free(config->mime_types);
+		config->mime_types = strdup(value);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Trim leading and trailing whitespace in place.
+ */
+static char* trim(char* s) {
+	while(isspace((unsigned char)*s)) s++;
+	char* end = s + strlen(s);
+	while(end > s && isspace((unsigned char)end[-1])) end--;
+	*end = '\0';
+	return s;
+}
+
+int config_load_file(Config* config, const char* path) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	char line[1024];
+	int lineno = 0;
+	int ret = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		char* s = trim(line);
+		if(*s == '\0' || *s == '#') {
+			continue;
+		}
+		char* eq = strchr(s, '=');
+		if(eq == NULL) {
+			fprintf(stderr, "%s:%d: expected name = value\n", path, lineno);
+			ret = -1;
+			continue;
+		}
+		*eq = '\0';
+		char* name = trim(s);
+		char* value = trim(eq + 1);
+		if(strcmp(name, "config") == 0 || config_set(config, name, value) < 0) {
+			fprintf(stderr, "%s:%d: bad setting '%s = %s'\n", path, lineno, name, value);
+			ret = -1;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static void usage(const char* prog, int status) {
+	FILE* out = status == 0 ? stdout : stderr;
+	fprintf(out, "usage: %s [options]\n", prog);
+	for(int i = 0; i < OPTION_COUNT; i++) {
+		char flag[64];
+		snprintf(flag, sizeof(flag), "--%s%s%s", options[i].name,
+			options[i].arg ? "=" : "", options[i].arg ? options[i].arg : "");
+		fprintf(out, "  %-26s %s\n", flag, options[i].help);
+	}
+	exit(status);
+}
+
+void config_parse_args(Config* config, int argc, char** argv) {
+	struct option longopts[OPTION_COUNT + 1];
+	for(int i = 0; i < OPTION_COUNT; i++) {
+		longopts[i].name = options[i].name;
+		longopts[i].has_arg = options[i].arg ? required_argument : no_argument;
+		longopts[i].flag = NULL;
+		longopts[i].val = 0;
+	}
+	memset(&longopts[OPTION_COUNT], 0, sizeof(struct option));
+
+	// The config file goes first so that flags can override it,
+	// wherever --config appears on the command line.
+	int index;
+	int c;
+	opterr = 0;
+	while((c = getopt_long(argc, argv, "", longopts, &index)) != -1) {
+		if(c == 0 && strcmp(options[index].name, "config") == 0 && config_load_file(config, optarg) < 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	optind = 1;
+	opterr = 1;
+	while((c = getopt_long(argc, argv, "", longopts, &index)) != -1) {
+		if(c != 0) {
+			usage(argv[0], EXIT_FAILURE);
+		}
+		const char* name = options[index].name;
+		if(strcmp(name, "help") == 0) {
+			usage(argv[0], 0);
+		}
+		if(strcmp(name, "config") == 0) {
+			continue;
+		}
+		if(config_set(config, name, optarg) < 0) {
+			fprintf(stderr, "%s: bad value '%s' for --%s\n", argv[0], optarg, name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(optind < argc) {
+		fprintf(stderr, "%s: unexpected argument '%s'\n", argv[0], argv[optind]);
+		usage(argv[0], EXIT_FAILURE);
+	}
+
+	if(config->workers == 0 && (config->model == MODEL_POOL || config->model == MODEL_EPOLL
+	                            || config->model == MODEL_STEAL)) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		config->workers = cpus > 0 ? 2 * (int)cpus : 8;
+	}
+	if(config->workers == 0 && config->model == MODEL_CORO) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		config->workers = cpus > 0 ? (int)cpus : 4;
+	}
+	if(config->queue_slots == 0) {
+		config->queue_slots = config->workers * QUEUE_SLOTS_PER_WORKER;
+	}
+	if(config->cache == CACHE_NONE && (config->warm_manifest || config->warm_log || config->warm_save)) {
+		fprintf(stderr, "%s: --warm-* need a cache\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	// A coroutine waiting to send holds the pq's lock, which the next
+	// coroutine on its thread would then wait for forever.
+	if(config->model == MODEL_CORO && config->cache == CACHE_PQ) {
+		fprintf(stderr, "%s: --model=coro cannot use --cache=pq\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	// A forked child's inserts would only ever land in its own copy.
+	if(config->model == MODEL_PROC && config->cache != CACHE_NONE) {
+		fprintf(stderr, "%s: --model=proc cannot share a cache, use --cache=none\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
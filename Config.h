@@ -0,0 +1,151 @@
+/**
+ * @file Config.h
+ * @brief Runtime configuration shared by all of the servers.
+ *
+ * Every knob can be given on the command line as `--name=value` (or
+ * `--name value`) or in a config file as `name = value`, one per line.
+ * Command-line flags override the config file.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/**
+ * @enum EvictionPolicy
+ * @brief Which cached response gets pushed out when the cache is full.
+ */
+typedef enum EvictionPolicy {
+	EVICT_FIFO, // oldest insertion goes first, hits don't matter
+	EVICT_LRU   // least recently requested goes first
+} EvictionPolicy;
+
+/**
+ * @enum ConcurrencyModel
+ * @brief How connections are spread over processes and threads.
+ */
+typedef enum ConcurrencyModel {
+	MODEL_PROC,   // fork() a process per connection
+	MODEL_THREAD, // create a thread per connection
+	MODEL_POOL,   // a fixed pool of threads fed by the accepting thread
+	MODEL_EPOLL,  // the pool, but only fed connections that have a request waiting
+	MODEL_STEAL,  // a pool with a work-stealing deque per worker, sending large bodies in slices
+	MODEL_CORO    // a coroutine per connection, on an epoll reactor per worker thread
+} ConcurrencyModel;
+
+/**
+ * @enum CacheBackend
+ * @brief Which response cache to use, see Cache.h.
+ */
+typedef enum CacheBackend {
+	CACHE_NONE,
+	CACHE_DEQUE,
+	CACHE_PQ,
+	CACHE_SHARDED
+} CacheBackend;
+
+/**
+ * @enum HugePages
+ * @brief What backs the Slab, and so every cached response, see Slab.h.
+ */
+typedef enum HugePages {
+	HUGE_PAGES_OFF,     // malloc()
+	HUGE_PAGES_THP,     // transparent huge pages, madvise()d
+	HUGE_PAGES_HUGETLB  // reserved huge pages (vm.nr_hugepages), THP once they run out
+} HugePages;
+
+typedef struct Config {
+	ConcurrencyModel model;
+	CacheBackend cache;
+	char* bind_address;     // dotted IPv4 address to listen on
+	int port;               // 0 picks an ephemeral port
+	int backlog;            // listen() backlog
+	int workers;            // pool size, or max concurrent connections for proc/thread
+	int cache_entries;      // max number of cached responses
+	int cache_shards;       // number of independently locked pieces for --cache=sharded
+	long cache_bytes;       // max total bytes of cached bodies, 0 = unlimited
+	EvictionPolicy eviction;
+	char* stats_log;        // per-request timing log
+	char* docroot;          // directory files are served from, NULL = cwd
+	int recv_buffer_size;   // bytes read from the client per recv()
+	int io_buffer_size;     // bytes read from disk per fread()
+	long read_buffer;       // bytes read per pread() from files too big for io_buffer_size
+	long direct_io;         // cold files this large are streamed with O_DIRECT, 0 = never
+	int disk_threads;       // threads disk reads are handed to, 0 = read on the network thread
+	int disk_queue_depth;   // reads running at once per device, 0 = no limit
+	int compress;           // compress text files on a miss when there is a cache
+	long compress_max;      // largest file compressed on a miss
+	char* mime_types;       // extra MIME types file, NULL = built-in only
+	int watch;              // invalidate cached files on inotify events
+	int revalidate;         // seconds between stat() checks of the cache, 0 = never
+	char* warm_manifest;    // files to preload, one per line
+	char* warm_log;         // stats log whose most requested files are preloaded
+	int warm_top;           // max files to preload, 0 = cache_entries
+	int warm_threads;       // files read at once while preloading
+	char* warm_save;        // where to write the cached files on shutdown
+	int neg_cache_entries;  // max number of missing paths remembered, 0 = off
+	int neg_cache_ttl;      // seconds a missing path is remembered for
+	int fd_cache_entries;   // max number of files kept open, 0 = off
+	long steal_slice;       // body bytes sent before a steal worker moves on
+	long coro_stack;        // stack size of each coroutine
+	int header_timeout;     // seconds a client gets to send its request, 0 = forever
+	int send_timeout;       // seconds a response may stall, 0 = forever
+	long min_send_rate;     // bytes a second a response must average, 0 = any
+	int max_conns;          // connections admitted at once, more get a 503, 0 = no limit
+	int adaptive_limit;     // move the limit with latency, up to max_conns
+	int queue_slots;        // connections waiting for a pool worker, 0 = 4 per worker
+	int queue_reject;       // 503 a connection when the queue is full, instead of waiting
+	int numa;               // pin workers to NUMA nodes and allocate node-locally
+	int numa_replicas;      // hot entries copied to each node, 0 = off
+	HugePages huge_pages;   // what backs cached responses
+	long cache_max_object;  // largest file read into the cache, larger ones are streamed; 0 = any
+	long admit_size;        // files this large are only cached after admit_after misses
+	int admit_after;        // misses before a file of admit_size or more is cached
+	long zerocopy_min;      // cached bodies this large are sent with MSG_ZEROCOPY, 0 = never
+} Config;
+
+/* The running server's configuration. */
+extern Config config;
+
+/**
+ * @brief Fill in the defaults, which match the original hardcoded values.
+ *
+ * @param config The Config to initialize.
+ * @param stats_log The default timing log for this server.
+ */
+void config_init(Config* config, const char* stats_log);
+
+/**
+ * @brief Apply a single `name`/`value` setting.
+ *
+ * @return 0 on success, -1 if the name is unknown or the value is invalid.
+ */
+int config_set(Config* config, const char* name, const char* value);
+
+/**
+ * @brief Load settings from a config file.
+ *
+ * Blank lines and lines starting with '#' are ignored.
+ *
+ * @return 0 on success, -1 on error (already reported on stderr).
+ */
+int config_load_file(Config* config, const char* path);
+
+/**
+ * @brief Parse the command line, including any `--config` file.
+ *
+ * Prints usage and exits on `--help` or on an invalid option.
+ * Also fills in defaults that depend on other settings, such as the
+ * pool size.
+ */
+void config_parse_args(Config* config, int argc, char** argv);
+
+/**
+ * @brief The name of a model or cache backend, for messages.
+ */
+const char* model_name(ConcurrencyModel model);
+const char* cache_name(CacheBackend cache);
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file ConnQueue.c
+ * @brief A bounded, blocking queue of accepted connections.
+ *
+ * A ring buffer behind a mutex and two condition variables.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "ConnQueue.h"
+
+int conn_queue_init(ConnQueue* q, int capacity) {
+	q->fds = malloc(capacity * sizeof(int));
+	if(q->fds == NULL) {
+		return -1;
+	}
+	q->capacity = capacity;
+	q->head = 0;
+	q->size = 0;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+void conn_queue_push(ConnQueue* q, int connfd) {
+	pthread_mutex_lock(&q->mutex);
+	while(q->size == q->capacity) {
+		pthread_cond_wait(&q->not_full, &q->mutex);
+	}
+	q->fds[(q->head + q->size) % q->capacity] = connfd;
+	q->size++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+int conn_queue_try_push(ConnQueue* q, int connfd) {
+	pthread_mutex_lock(&q->mutex);
+	if(q->size == q->capacity) {
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+	q->fds[(q->head + q->size) % q->capacity] = connfd;
+	q->size++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
+int conn_queue_pop(ConnQueue* q) {
+	pthread_mutex_lock(&q->mutex);
+	while(q->size == 0) {
+		pthread_cond_wait(&q->not_empty, &q->mutex);
+	}
+	int connfd = q->fds[q->head];
+	q->head = (q->head + 1) % q->capacity;
+	q->size--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
+	return connfd;
+}
+
+int conn_queue_try_pop(ConnQueue* q) {
+	pthread_mutex_lock(&q->mutex);
+	if(q->size == 0) {
+		pthread_mutex_unlock(&q->mutex);
+		return -1;
+	}
+	int connfd = q->fds[q->head];
+	q->head = (q->head + 1) % q->capacity;
+	q->size--;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
+	return connfd;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file ConnQueue.h
+ * @brief A bounded, blocking queue of accepted connections.
+ *
+ * The accepting thread pushes client sockets, worker threads pop them.
+ * A full queue makes the acceptor wait, which pushes back on clients
+ * through the listen() backlog, unless it uses conn_queue_try_push()
+ * to turn them away instead.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef CONN_QUEUE_H
+#define CONN_QUEUE_H
+
+#include <pthread.h>
+
+typedef struct ConnQueue {
+	int* fds;
+	int capacity;
+	int head;  // next slot to pop
+	int size;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} ConnQueue;
+
+/**
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conn_queue_init(ConnQueue* q, int capacity);
+
+/**
+ * @brief Add a connection, waiting while the queue is full.
+ */
+void conn_queue_push(ConnQueue* q, int connfd);
+
+/**
+ * @brief Add a connection if there is room, without waiting.
+ *
+ * @return 0 on success, -1 if the queue is full.
+ */
+int conn_queue_try_push(ConnQueue* q, int connfd);
+
+/**
+ * @brief Take the oldest connection, waiting while the queue is empty.
+ */
+int conn_queue_pop(ConnQueue* q);
+
+/**
+ * @brief Take the oldest connection if there is one, without waiting.
+ *
+ * @return The connection, or -1 if the queue is empty.
+ */
+int conn_queue_try_pop(ConnQueue* q);
+
+#endif
@@ -0,0 +1,296 @@
+/**
+ * @file Coro.c
+ * @brief Stackful coroutines on an epoll reactor, for --model=coro.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include "Coro.h"
+#include "Admission.h"
+
+/**
+ * @struct Coro
+ * @brief A coroutine, with its stack. Finished ones are kept for reuse.
+ */
+typedef struct Coro {
+	ucontext_t context;
+	char* stack;           // mmap()ed, with a guard page at the bottom
+	int connfd;
+	void* local;           // see coro_local()
+	struct Scheduler* owner;
+	struct Coro* next;     // in the ready queue, the free list or the woken list
+} Coro;
+
+/**
+ * @struct Scheduler
+ * @brief One worker thread's coroutines.
+ */
+typedef struct Scheduler {
+	ucontext_t context;    // the loop in coro_run()
+	Coro* current;         // NULL while in the loop
+	Coro* ready_head;
+	Coro* ready_tail;
+	Coro* free_list;
+	int epfd;
+	size_t stack_size;
+	void (*serve)(int connfd);
+	int finished;          // current returned from serve
+	int wakefd;            // eventfd, written by coro_wake() from other threads
+	pthread_mutex_t wake_mutex;
+	Coro* woken;           // guarded by wake_mutex
+} Scheduler;
+
+static pthread_key_t scheduler_key;
+static pthread_once_t scheduler_once = PTHREAD_ONCE_INIT;
+
+static void create_scheduler_key(void) {
+	pthread_key_create(&scheduler_key, NULL);
+}
+
+static Scheduler* this_scheduler(void) {
+	pthread_once(&scheduler_once, create_scheduler_key);
+	return pthread_getspecific(scheduler_key);
+}
+
+static void make_ready(Scheduler* s, Coro* c) {
+	c->next = NULL;
+	if(s->ready_tail != NULL) {
+		s->ready_tail->next = c;
+	} else {
+		s->ready_head = c;
+	}
+	s->ready_tail = c;
+}
+
+/**
+ * @brief Where every coroutine starts.
+ *
+ * makecontext() only passes ints, so the coroutine is found through
+ * the scheduler instead.
+ */
+static void coro_main(void) {
+	Scheduler* s = this_scheduler();
+	for(;;) {
+		s->serve(s->current->connfd);
+		//back to the loop, which puts us on the free list; when we are
+		//reused we carry on from here with the next connection
+		s->finished = 1;
+		swapcontext(&s->current->context, &s->context);
+		s = this_scheduler();
+	}
+}
+
+/**
+ * @brief A coroutine for connfd, reusing a finished one if there is one.
+ */
+static Coro* spawn(Scheduler* s, int connfd) {
+	Coro* c = s->free_list;
+	if(c != NULL) {
+		s->free_list = c->next;
+		c->connfd = connfd;
+		make_ready(s, c);
+		return c;
+	}
+
+	c = calloc(1, sizeof(Coro));
+	if(c == NULL) {
+		return NULL;
+	}
+	long page = sysconf(_SC_PAGESIZE);
+	size_t size = (s->stack_size + page - 1) / page * page;
+	c->stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if(c->stack == MAP_FAILED) {
+		free(c);
+		return NULL;
+	}
+	//an overflow faults instead of scribbling on the next stack
+	mprotect(c->stack, page, PROT_NONE);
+
+	getcontext(&c->context);
+	c->context.uc_stack.ss_sp = c->stack + page;
+	c->context.uc_stack.ss_size = size;
+	c->context.uc_link = NULL;
+	makecontext(&c->context, coro_main, 0);
+	c->connfd = connfd;
+	c->owner = s;
+	make_ready(s, c);
+	return c;
+}
+
+/**
+ * @brief Accept every waiting connection and give each a coroutine.
+ */
+static void accept_all(Scheduler* s, int sfd) {
+	for(;;) {
+		int connfd = admission_accept(sfd, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(connfd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("Accept failed");
+			}
+			return;
+		}
+		if(spawn(s, connfd) == NULL) {
+			perror("could not allocate a coroutine");
+			admission_turn_away(connfd);
+		}
+	}
+}
+
+/**
+ * @brief Make ready every coroutine other threads have woken.
+ */
+static void take_woken(Scheduler* s) {
+	uint64_t count;
+	while(read(s->wakefd, &count, sizeof(count)) < 0 && errno == EINTR)
+		/* retry */;
+	pthread_mutex_lock(&s->wake_mutex);
+	Coro* c = s->woken;
+	s->woken = NULL;
+	pthread_mutex_unlock(&s->wake_mutex);
+	while(c != NULL) {
+		Coro* next = c->next;
+		make_ready(s, c);
+		c = next;
+	}
+}
+
+void coro_run(int sfd, size_t stack_size, void (*serve)(int connfd)) {
+	Scheduler* s = calloc(1, sizeof(Scheduler));
+	if(s == NULL) {
+		perror("could not allocate the coroutine scheduler");
+		exit(EXIT_FAILURE);
+	}
+	s->stack_size = stack_size;
+	s->serve = serve;
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	s->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(s->wakefd < 0) {
+		perror("eventfd");
+		exit(EXIT_FAILURE);
+	}
+	pthread_mutex_init(&s->wake_mutex, NULL);
+	this_scheduler();
+	pthread_setspecific(scheduler_key, s);
+
+	//Only one of the threads waiting on the socket is woken for it
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, sfd, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = s;
+	if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wakefd, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+
+	struct epoll_event events[64];
+	for(;;) {
+		while(s->ready_head != NULL) {
+			Coro* c = s->ready_head;
+			s->ready_head = c->next;
+			if(s->ready_head == NULL) {
+				s->ready_tail = NULL;
+			}
+			s->current = c;
+			s->finished = 0;
+			swapcontext(&s->context, &c->context);
+			s->current = NULL;
+			if(s->finished) {
+				c->next = s->free_list;
+				s->free_list = c;
+			}
+		}
+
+		int n = epoll_wait(s->epfd, events, 64, -1);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		for(int i = 0; i < n; i++) {
+			if(events[i].data.ptr == NULL) {
+				accept_all(s, sfd);
+			} else if(events[i].data.ptr == s) {
+				take_woken(s);
+			} else {
+				make_ready(s, events[i].data.ptr);
+			}
+		}
+	}
+}
+
+void coro_wait(int fd, short events) {
+	Scheduler* s = this_scheduler();
+	if(s == NULL || s->current == NULL) {
+		struct pollfd pfd = { .fd = fd, .events = events };
+		poll(&pfd, 1, -1);
+		return;
+	}
+
+	//One-shot, so a ready fd wakes its coroutine exactly once; it is
+	//dropped from the set when the connection is closed
+	struct epoll_event ev;
+	ev.events = (events & POLLOUT ? EPOLLOUT : 0) | (events & POLLIN ? EPOLLIN : 0)
+	            | EPOLLRDHUP | EPOLLONESHOT;
+	ev.data.ptr = s->current;
+	if(epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) < 0
+	   && (errno != ENOENT || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)) {
+		//can't wait for it, so let the caller find out by retrying
+		return;
+	}
+	swapcontext(&s->current->context, &s->context);
+}
+
+void* coro_self(void) {
+	Scheduler* s = this_scheduler();
+	return s != NULL ? s->current : NULL;
+}
+
+void coro_suspend(void) {
+	Scheduler* s = this_scheduler();
+	swapcontext(&s->current->context, &s->context);
+}
+
+void coro_wake(void* coro) {
+	Coro* c = coro;
+	Scheduler* s = c->owner;
+	pthread_mutex_lock(&s->wake_mutex);
+	c->next = s->woken;
+	s->woken = c;
+	pthread_mutex_unlock(&s->wake_mutex);
+	uint64_t one = 1;
+	while(write(s->wakefd, &one, sizeof(one)) < 0 && errno == EINTR)
+		/* retry */;
+}
+
+void** coro_local(void) {
+	Scheduler* s = this_scheduler();
+	if(s == NULL || s->current == NULL) {
+		return NULL;
+	}
+	return &s->current->local;
+}
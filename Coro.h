@@ -0,0 +1,83 @@
+/**
+ * @file Coro.h
+ * @brief Stackful coroutines on an epoll reactor, for --model=coro.
+ *
+ * Each worker thread runs coro_run(), which accepts connections and
+ * serves each one on a coroutine of its own, with its own small stack.
+ * The request handler stays the same blocking-style code as for every
+ * other model: sockets are non-blocking, and where a send or recv would
+ * block, the handler calls coro_wait(), which parks the coroutine in
+ * the thread's epoll set and runs another one. Thousands of connections
+ * then cost a stack each (--coro-stack) rather than a kernel thread.
+ *
+ * A coroutine must not yield while holding a lock another coroutine on
+ * the same thread could want, which is why the pq cache, locked for
+ * the whole send, can't be used with it. Disk reads are handed to the
+ * I/O threads of DiskPool.h, which wake the coroutine with coro_wake()
+ * once they are done.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef CORO_H
+#define CORO_H
+
+#include <stddef.h>
+
+/**
+ * @brief Serve connections from a listening socket on coroutines, forever.
+ *
+ * Every worker thread calls this with the same socket; the kernel
+ * wakes one of them per new connection.
+ *
+ * @param sfd The listening socket, non-blocking.
+ * @param stack_size Bytes of stack per coroutine.
+ * @param serve Called on a new coroutine for each connection; it must
+ *              close the connection before returning.
+ */
+void coro_run(int sfd, size_t stack_size, void (*serve)(int connfd));
+
+/**
+ * @brief Wait until fd is ready.
+ *
+ * On a coroutine, this yields to the others until it is. Anywhere else
+ * it simply poll()s.
+ *
+ * @param fd The descriptor.
+ * @param events POLLIN or POLLOUT.
+ */
+void coro_wait(int fd, short events);
+
+/**
+ * @return The calling coroutine, for coro_wake(), or NULL when not on one.
+ */
+void* coro_self(void);
+
+/**
+ * @brief Yield until another thread calls coro_wake() on this coroutine.
+ *
+ * Only call it on a coroutine.
+ */
+void coro_suspend(void);
+
+/**
+ * @brief Make a suspended coroutine runnable again, from any thread.
+ *
+ * It runs next time its own thread gets round to it. Calling this
+ * before the coroutine has got as far as coro_suspend() is fine, as
+ * long as the call comes from another thread.
+ */
+void coro_wake(void* coro);
+
+/**
+ * @brief A pointer of the calling coroutine's own, like pthread_getspecific().
+ *
+ * It starts out NULL and is kept, along with the stack, when the
+ * coroutine is reused for another connection.
+ *
+ * @return The slot, or NULL when not called on a coroutine.
+ */
+void** coro_local(void);
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * @file Deque.c
+ * @brief A linked-list with reference counting to cache responses.
+ *
+ * Moved out of server_cached.c so that it can back more than one cache.
+ * This way, multiple threads can have access to the cache concurrently.
+ * However, it does introduce higher memory usage as multiple versions of
+ * the same cached response can exist as evicted entries that have
+ * yet to be 'put-down' or freed.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Deque.h"
+
+/**
+ * @brief Initialize an empty deck.
+ *
+ * @param deck The deck to initialize.
+ * @param capacity The maximum number of entries.
+ * @param max_bytes The maximum total size of cached bodies, or 0 for no limit.
+ * @param refresh_on_hit 1 to evict the least recently used entry,
+ *                       0 to evict the oldest insertion.
+ */
+void deque_init(Deque* deck, int capacity, long max_bytes, int refresh_on_hit) {
+	deck->head = NULL;
+	deck->tail = NULL;
+	deck->size = 0;
+	deck->bytes = 0;
+	deck->capacity = capacity;
+	deck->max_bytes = max_bytes;
+	deck->refresh_on_hit = refresh_on_hit;
+}
+
+/**
+ * @brief Take a response out of the list, without dropping the reference.
+ */
+static void unlink_response(Deque* deck, HttpResponse* resp) {
+	if(resp->prev != NULL) {
+		resp->prev->next = resp->next;
+	} else {
+		deck->head = resp->next;
+	}
+	if(resp->next != NULL) {
+		resp->next->prev = resp->prev;
+	} else {
+		deck->tail = resp->prev;
+	}
+	resp->prev = NULL;
+	resp->next = NULL;
+}
+
+/**
+ * @brief Put a response at the head of the list.
+ */
+static void push_front(Deque* deck, HttpResponse* resp) {
+	resp->prev = NULL;
+	resp->next = deck->head;
+	if(deck->head != NULL) {
+		deck->head->prev = resp;
+	} else {
+		deck->tail = resp;
+	}
+	deck->head = resp;
+}
+
+/**
+ * @brief Search the deck.
+ *
+ * Search the deck for a cached response with a matching filename.
+ * The hash is compared first, so most misses never touch the key.
+ * If a response is found, a reference is picked up for the caller,
+ * who must put_down() it when done.
+ * If no match is found, return NULL.
+ *
+ * @param deck The Deque struct maintaining the cache.
+ * @param filename The filename to search the cache for.
+ * @param hash http_response_hash() of filename.
+ * @param encoding Which variant of filename.
+ * @return The HttpResponse containing the desired response, or NULL.
+ */
+HttpResponse* deque_search(Deque* deck, const char* filename, unsigned long hash, ContentEncoding encoding) {
+	HttpResponse* curr;
+	for(curr = deck->head; curr != NULL; curr = curr->next) {
+		if(http_response_matches(curr, filename, hash, encoding)) {
+			pick_up(curr);
+			// Used for LRU eviction, so the tail is always the least
+			// recently requested response.
+			if(deck->refresh_on_hit && curr != deck->head) {
+				unlink_response(deck, curr);
+				push_front(deck, curr);
+			}
+			return curr;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Remove a response from the deck and drop the deck's reference.
+ *
+ * Threads still sending it keep it alive until they put it down.
+ *
+ * @param deck The deck containing resp.
+ * @param resp The response to remove.
+ */
+void deque_remove(Deque* deck, HttpResponse* resp) {
+	unlink_response(deck, resp);
+	deck->size--;
+	deck->bytes -= resp->filesize;
+	put_down(resp);
+}
+
+/**
+ * @brief Remove the tail of the deck.
+ *
+ * This method is called when a new entry is enqueued
+ * into a full cache.
+ *
+ * @param deck The deck whose tail is to be removed.
+ */
+void remove_tail(Deque* deck) {
+	deque_remove(deck, deck->tail);
+}
+
+/**
+ * @brief Remove every encoding of a file from the deck.
+ *
+ * @param deck The deck to remove from.
+ * @param filename The filename to remove.
+ * @param hash http_response_hash() of filename.
+ * @return The number of entries removed.
+ */
+int deque_invalidate(Deque* deck, const char* filename, unsigned long hash) {
+	int removed = 0;
+	HttpResponse* curr = deck->head;
+	while(curr != NULL) {
+		HttpResponse* next = curr->next;
+		if(curr->hash == hash && strcmp(http_response_key(curr), filename) == 0) {
+			deque_remove(deck, curr);
+			removed++;
+		}
+		curr = next;
+	}
+	return removed;
+}
+
+/**
+ * @brief Remove every entry from the deck.
+ *
+ * @param deck The deck to empty.
+ */
+void deque_clear(Deque* deck) {
+	while(deck->tail != NULL) {
+		remove_tail(deck);
+	}
+}
+
+/**
+ * @brief Enqueue a new entry into the deck.
+ *
+ * The deck picks up its own reference; the caller keeps theirs.
+ * Entries are removed from the tail until the new one fits
+ * within both the entry and the byte limit.
+ *
+ * @param deck The Deque into which the data will be enqueued.
+ * @param new The data to be enqueued into the deck.
+ * @return 1 if it was cached, 0 if it is too big for the deck.
+ */
+int deque_enqueue(Deque* deck, HttpResponse* new) {
+	if(deck->max_bytes > 0 && (long)new->filesize > deck->max_bytes) {
+		return 0;
+	}
+
+	// make room
+	while(deck->size > 0 && (deck->size >= deck->capacity
+	      || (deck->max_bytes > 0 && deck->bytes + (long)new->filesize > deck->max_bytes))) {
+		remove_tail(deck);
+	}
+
+	pick_up(new);
+	push_front(deck, new);
+	deck->size++;
+	deck->bytes += new->filesize;
+	return 1;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file Deque.h
+ * @brief A reference-counted linked-list cache of HTTP responses.
+ *
+ * The list is threaded through the responses themselves (their prev
+ * and next links), so caching a response costs no extra allocation.
+ * Multiple threads can be sending the same cached response at once:
+ * deque_search() picks up a reference for the caller, who puts it down
+ * when done. A response that falls off the end of the list while it
+ * is still being sent is freed by the last thread to put it down.
+ * None of the functions lock; callers hold a mutex around them.
+ * put_down() needs no lock at all.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include "HttpResponse.h"
+
+/**
+ * @struct Deque
+ * @brief A Doubly-Linked linked-list.
+ */
+typedef struct Deque {
+	HttpResponse* head;
+	HttpResponse* tail;
+	int size;
+	long bytes;         // total size of the cached bodies
+	int capacity;       // max number of entries
+	long max_bytes;     // limit on bytes, 0 = unlimited
+	int refresh_on_hit; // 1 = LRU, 0 = FIFO
+} Deque;
+
+void deque_init(Deque* deck, int capacity, long max_bytes, int refresh_on_hit);
+
+HttpResponse* deque_search(Deque* deck, const char* filename, unsigned long hash, ContentEncoding encoding);
+
+void deque_remove(Deque* deck, HttpResponse* resp);
+
+void remove_tail(Deque* deck);
+
+int deque_invalidate(Deque* deck, const char* filename, unsigned long hash);
+
+void deque_clear(Deque* deck);
+
+int deque_enqueue(Deque* deck, HttpResponse* new);
+
+#endif
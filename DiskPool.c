@@ -0,0 +1,220 @@
+/**
+ * @file DiskPool.c
+ * @brief Disk I/O on threads of its own, so network workers never wait on a disk.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "DiskPool.h"
+#include "Config.h"
+#include "Coro.h"
+
+/**
+ * @struct DiskJob
+ * @brief One call waiting for, or on, an I/O thread. Lives on the caller's stack.
+ */
+typedef struct DiskJob {
+	void (*fn)(void* arg);
+	void* arg;
+	struct DiskJob* next;
+	int done;
+	void* coro;               // the coroutine to wake, or NULL
+	pthread_cond_t* cond;     // otherwise, what the caller waits on
+} DiskJob;
+
+/**
+ * @struct Device
+ * @brief The calls queued for one device.
+ */
+typedef struct Device {
+	dev_t dev;
+	int running;              // on I/O threads right now
+	DiskJob* head;
+	DiskJob* tail;
+} Device;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static Device devices[DISK_MAX_DEVICES];
+static int device_count;
+static int next_device;       // where the next scan for work starts
+static int started;
+
+/**
+ * @brief The next call a device has room for, round-robin over the devices.
+ *
+ * Called with the mutex held.
+ */
+static DiskJob* take(Device** from) {
+	for(int i = 0; i < device_count; i++) {
+		Device* d = &devices[(next_device + i) % device_count];
+		if(d->head == NULL || (config.disk_queue_depth > 0 && d->running >= config.disk_queue_depth)) {
+			continue;
+		}
+		DiskJob* job = d->head;
+		d->head = job->next;
+		if(d->head == NULL) {
+			d->tail = NULL;
+		}
+		d->running++;
+		next_device = (next_device + i + 1) % device_count;
+		*from = d;
+		return job;
+	}
+	return NULL;
+}
+
+static void* io_thread(void* arg) {
+	(void)arg;
+	pthread_mutex_lock(&mutex);
+	for(;;) {
+		Device* d;
+		DiskJob* job = take(&d);
+		if(job == NULL) {
+			pthread_cond_wait(&work, &mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&mutex);
+		job->fn(job->arg);
+		pthread_mutex_lock(&mutex);
+
+		d->running--;
+		if(d->head != NULL) {
+			//one of its queued calls may have been passed over for room
+			pthread_cond_signal(&work);
+		}
+		void* coro = job->coro;
+		job->done = 1;
+		if(coro != NULL) {
+			//job is gone as soon as the coroutine runs again
+			pthread_mutex_unlock(&mutex);
+			coro_wake(coro);
+			pthread_mutex_lock(&mutex);
+		} else {
+			pthread_cond_signal(job->cond);
+		}
+	}
+	return NULL;
+}
+
+int disk_pool_start(void) {
+	if(config.disk_threads == 0) {
+		return 0;
+	}
+	for(int i = 0; i < config.disk_threads; i++) {
+		pthread_t tid;
+		if(pthread_create(&tid, NULL, io_thread, NULL) != 0) {
+			//fewer threads than asked for still work, none don't
+			if(i == 0) {
+				return -1;
+			}
+			break;
+		}
+		pthread_detach(tid);
+	}
+	started = 1;
+	return 0;
+}
+
+/**
+ * @brief The queue for dev, adding it if it's new. Called with the mutex held.
+ */
+static Device* device_for(dev_t dev) {
+	for(int i = 0; i < device_count; i++) {
+		if(devices[i].dev == dev) {
+			return &devices[i];
+		}
+	}
+	if(device_count == DISK_MAX_DEVICES) {
+		return &devices[DISK_MAX_DEVICES - 1];
+	}
+	Device* d = &devices[device_count++];
+	d->dev = dev;
+	return d;
+}
+
+void disk_run(dev_t dev, void (*fn)(void* arg), void* arg) {
+	if(!started) {
+		fn(arg);
+		return;
+	}
+
+	pthread_cond_t cond;
+	DiskJob job = { fn, arg, NULL, 0, coro_self(), NULL };
+	if(job.coro == NULL) {
+		pthread_cond_init(&cond, NULL);
+		job.cond = &cond;
+	}
+
+	pthread_mutex_lock(&mutex);
+	Device* d = device_for(dev);
+	if(d->tail != NULL) {
+		d->tail->next = &job;
+	} else {
+		d->head = &job;
+	}
+	d->tail = &job;
+	pthread_cond_signal(&work);
+
+	if(job.coro != NULL) {
+		//Woken from our own thread's loop, which can't run before we
+		//have yielded, so the wake-up can't come too early
+		pthread_mutex_unlock(&mutex);
+		coro_suspend();
+		return;
+	}
+	while(!job.done) {
+		pthread_cond_wait(&cond, &mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+	pthread_cond_destroy(&cond);
+}
+
+/**
+ * @struct Read
+ * @brief The arguments and result of a disk_pread().
+ */
+typedef struct Read {
+	int fd;
+	void* buf;
+	size_t len;
+	off_t offset;
+	ssize_t result;
+	int error;
+} Read;
+
+static void do_pread(void* arg) {
+	Read* r = arg;
+	do {
+		r->result = pread(r->fd, r->buf, r->len, r->offset);
+	} while(r->result < 0 && errno == EINTR);
+	r->error = errno;
+}
+
+ssize_t disk_pread(int fd, dev_t dev, void* buf, size_t len, off_t offset) {
+	if(started) {
+		//What the page cache has costs no trip to another thread
+		struct iovec iov = { buf, len };
+		ssize_t n;
+		do {
+			n = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+		} while(n < 0 && errno == EINTR);
+		if(n > 0 || (n == 0 && len > 0)) {
+			return n;
+		}
+	}
+	Read r = { fd, buf, len, offset, 0, 0 };
+	disk_run(dev, do_pread, &r);
+	if(r.result < 0) {
+		errno = r.error;
+	}
+	return r.result;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file DiskPool.h
+ * @brief Disk I/O on threads of its own, so network workers never wait on a disk.
+ *
+ * A worker that needs the disk hands the call to disk_run() and sleeps
+ * until an I/O thread has made it: a coroutine yields to the others on
+ * its thread, see Coro.h; a thread waits on a condition variable. The
+ * worker's own buffer is read into, so the data needs no copying back.
+ *
+ * Calls are queued by device, and at most --disk-queue-depth of one
+ * device's run at once, so a slow disk holds up only the I/O threads
+ * it is allowed, and the others keep serving the rest. A spinning disk
+ * wants a short queue; an SSD a long one.
+ *
+ * With --disk-threads=0, and with --model=proc, where each connection
+ * has a process of its own anyway, everything runs on the caller.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef DISK_POOL_H
+#define DISK_POOL_H
+
+#include <sys/types.h>
+
+/* Devices beyond this many share the last queue. */
+#define DISK_MAX_DEVICES 16
+
+/**
+ * @brief Start the I/O threads.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int disk_pool_start(void);
+
+/**
+ * @brief Call fn(arg) on an I/O thread and wait for it to return.
+ *
+ * @param dev The device fn works on, e.g. st_dev from fstat().
+ */
+void disk_run(dev_t dev, void (*fn)(void* arg), void* arg);
+
+/**
+ * @brief pread() on an I/O thread, retrying on EINTR.
+ *
+ * Whatever of it is already in the page cache is read right away
+ * instead, which may be less than len.
+ *
+ * @return What pread() returned; errno is set on error.
+ */
+ssize_t disk_pread(int fd, dev_t dev, void* buf, size_t len, off_t offset);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file Encoding.c
+ * @brief Content-Encoding negotiation and compression.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "Encoding.h"
+#include "Request.h"
+#include "Mime.h"
+
+/* Compression happens once per file, so favour size over speed. */
+#define GZIP_LEVEL Z_BEST_COMPRESSION
+#define BROTLI_QUALITY 9
+
+static const char* encoding_names[] = { "identity", "gzip", "br" };
+static const char* encoding_suffixes[] = { "", ".gz", ".br" };
+
+const char* encoding_name(ContentEncoding encoding) {
+	return encoding_names[encoding];
+}
+
+const char* encoding_suffix(ContentEncoding encoding) {
+	return encoding_suffixes[encoding];
+}
+
+int encoding_compressible(const char* filename) {
+	return mime_compressible(mime_type(filename));
+}
+
+/**
+ * @brief Which encoding does a coding token name?
+ *
+ * @return The encoding, ENCODING_COUNT for "*", or -1 if unknown.
+ */
+static int lookup_coding(const char* coding, size_t len) {
+	if(len == 1 && *coding == '*') {
+		return ENCODING_COUNT;
+	}
+	if(len == 6 && strncasecmp(coding, "x-gzip", 6) == 0) {
+		return ENCODING_GZIP;
+	}
+	for(int i = 0; i < ENCODING_COUNT; i++) {
+		if(strlen(encoding_names[i]) == len && strncasecmp(coding, encoding_names[i], len) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int accepted_encodings(const char* request) {
+	size_t len;
+	const char* value = request_header(request, "Accept-Encoding", &len);
+	if(value == NULL) {
+		return 0;
+	}
+
+	//codings listed by name, and whether each has a q above zero
+	int listed = 0;
+	int accepted = 0;
+	int wildcard = 0;
+	const char* p = value;
+	const char* end = value + len;
+	while(p < end) {
+		while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+			p++;
+		}
+		const char* coding = p;
+		while(p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+			p++;
+		}
+		size_t coding_len = p - coding;
+
+		//an optional weight, e.g. ";q=0.5"; q=0 means "not acceptable"
+		int acceptable = 1;
+		while(p < end && *p != ',') {
+			if(*p == '=' && p > value && (p[-1] == 'q' || p[-1] == 'Q')) {
+				acceptable = strtod(p + 1, NULL) > 0;
+			}
+			p++;
+		}
+
+		if(coding_len == 0) {
+			continue;
+		}
+		int encoding = lookup_coding(coding, coding_len);
+		if(encoding == ENCODING_COUNT) {
+			wildcard = acceptable;
+		} else if(encoding >= 0) {
+			listed |= 1 << encoding;
+			if(acceptable) {
+				accepted |= 1 << encoding;
+			}
+		}
+	}
+
+	// "*" covers every coding not listed by name
+	if(wildcard) {
+		accepted |= ((1 << ENCODING_COUNT) - 1) & ~listed;
+	}
+	return accepted & ~(1 << ENCODING_IDENTITY);
+}
+
+long encoding_bound(ContentEncoding encoding, long len) {
+	switch(encoding) {
+	case ENCODING_GZIP:
+		// deflateBound() plus the gzip header and trailer
+		return compressBound(len) + 18;
+	case ENCODING_BROTLI: {
+		size_t bound = BrotliEncoderMaxCompressedSize(len);
+		return bound == 0 ? -1 : (long)bound;
+	}
+	default:
+		return len;
+	}
+}
+
+static long gzip_compress(const char* in, long len, char* out, long out_size) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	// 16 + 15 asks for a gzip wrapper with the largest window
+	if(deflateInit2(&stream, GZIP_LEVEL, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return -1;
+	}
+	stream.next_in = (Bytef*)in;
+	stream.avail_in = len;
+	stream.next_out = (Bytef*)out;
+	stream.avail_out = out_size;
+	int ret = deflate(&stream, Z_FINISH);
+	long out_len = stream.total_out;
+	deflateEnd(&stream);
+	return ret == Z_STREAM_END ? out_len : -1;
+}
+
+long encoding_compress(ContentEncoding encoding, const char* in, long len, char* out, long out_size) {
+	switch(encoding) {
+	case ENCODING_GZIP:
+		return gzip_compress(in, len, out, out_size);
+	case ENCODING_BROTLI: {
+		size_t out_len = out_size;
+		if(!BrotliEncoderCompress(BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+		                          len, (const uint8_t*)in, &out_len, (uint8_t*)out)) {
+			return -1;
+		}
+		return out_len;
+	}
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,69 @@
+/**
+ * @file Encoding.h
+ * @brief Content-Encoding negotiation and compression.
+ *
+ * Text files can be sent gzip or brotli compressed to clients that
+ * accept it. A compressed variant comes from a precompressed sibling
+ * on disk (foo.html.gz, foo.html.br) if there is one; otherwise, with
+ * a cache, the file is compressed once on its first miss and the
+ * result is cached next to the identity entry under the same filename.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+/**
+ * @enum ContentEncoding
+ * @brief The encodings a body can be sent in, in increasing preference.
+ */
+typedef enum ContentEncoding {
+	ENCODING_IDENTITY,
+	ENCODING_GZIP,
+	ENCODING_BROTLI,
+	ENCODING_COUNT
+} ContentEncoding;
+
+/**
+ * @brief The compressed encodings a request's Accept-Encoding allows.
+ *
+ * @return A bit mask with bit (1 << encoding) set for each of them.
+ */
+int accepted_encodings(const char* request);
+
+/**
+ * @brief The Content-Encoding token, e.g. "gzip".
+ */
+const char* encoding_name(ContentEncoding encoding);
+
+/**
+ * @brief The suffix of a precompressed sibling, e.g. ".gz", or "".
+ */
+const char* encoding_suffix(ContentEncoding encoding);
+
+/**
+ * @brief Is this file worth compressing?
+ *
+ * Only text types are (see mime_compressible()); images, archives
+ * and the like already are compressed.
+ */
+int encoding_compressible(const char* filename);
+
+/**
+ * @brief The most bytes encoding_compress() can produce for len bytes.
+ *
+ * @return The bound, or -1 if len is too large to compress.
+ */
+long encoding_bound(ContentEncoding encoding, long len);
+
+/**
+ * @brief Compress a whole body.
+ *
+ * @param out Room for at least encoding_bound() bytes.
+ * @return The compressed length, or -1 on failure.
+ */
+long encoding_compress(ContentEncoding encoding, const char* in, long len, char* out, long out_size);
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * @file FdCache.c
+ * @brief A table of open files, so a hot file isn't opened on every request.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "FdCache.h"
+#include "HttpResponse.h"
+#include "DiskPool.h"
+
+static int docroot_fd = AT_FDCWD;
+static dev_t docroot_dev;       // where lookups go to the DiskPool
+static atomic_int have_openat2 = 1;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static OpenFile** buckets;
+static unsigned long bucket_count;
+static OpenFile* head;          // most recently used
+static OpenFile* tail;
+static int size;
+static int capacity;
+static int check_stat_on_hit;
+static atomic_ulong generation; // bumped by every invalidation
+
+int fd_cache_init(int entries, int check_stat) {
+	int fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if(fd < 0) {
+		return -1;
+	}
+	docroot_fd = fd;
+	struct stat st;
+	if(fstat(fd, &st) == 0) {
+		docroot_dev = st.st_dev;
+	}
+	if(entries <= 0) {
+		return 0;
+	}
+	bucket_count = entries * 2;
+	buckets = calloc(bucket_count, sizeof(OpenFile*));
+	if(buckets == NULL) {
+		return -1;
+	}
+	capacity = entries;
+	check_stat_on_hit = check_stat;
+	return 0;
+}
+
+/**
+ * @brief openat() that can't leave the docroot, where the kernel has openat2().
+ */
+static int open_beneath(const char* path, int flags) {
+	if(atomic_load_explicit(&have_openat2, memory_order_relaxed)) {
+		//Paths are already normalized, so this is for symlinks
+		//pointing outside
+		struct open_how how = { .flags = flags, .resolve = RESOLVE_BENEATH };
+		int fd = syscall(SYS_openat2, docroot_fd, path, &how, sizeof(how));
+		if(fd >= 0 || errno != ENOSYS) {
+			return fd;
+		}
+		atomic_store_explicit(&have_openat2, 0, memory_order_relaxed);
+	}
+	return openat(docroot_fd, path, flags);
+}
+
+int docroot_open(const char* path, int flags) {
+	int fd = open_beneath(path, flags | O_NOATIME | O_CLOEXEC);
+	if(fd < 0 && errno == EPERM) {
+		//O_NOATIME is only for the file's owner
+		fd = open_beneath(path, flags | O_CLOEXEC);
+	}
+	return fd;
+}
+
+static void release(OpenFile* file) {
+	if(atomic_fetch_sub_explicit(&file->reference_count, 1, memory_order_acq_rel) == 1) {
+		close(file->fd);
+		free(file);
+	}
+}
+
+/**
+ * @brief Take a file out of the table and drop its reference. Called locked.
+ */
+static void remove_file_locked(OpenFile* file) {
+	OpenFile** link = &buckets[file->hash % bucket_count];
+	while(*link != file) {
+		link = &(*link)->chain;
+	}
+	*link = file->chain;
+
+	if(file->prev != NULL) {
+		file->prev->next = file->next;
+	} else {
+		head = file->next;
+	}
+	if(file->next != NULL) {
+		file->next->prev = file->prev;
+	} else {
+		tail = file->prev;
+	}
+	file->cached = 0;
+	size--;
+	release(file);
+}
+
+static void push_front(OpenFile* file) {
+	file->prev = NULL;
+	file->next = head;
+	if(head != NULL) {
+		head->prev = file;
+	} else {
+		tail = file;
+	}
+	head = file;
+}
+
+/**
+ * @brief Is the file at path still the one we have open?
+ */
+static int still_current(const OpenFile* file) {
+	struct stat st;
+	return fstatat(docroot_fd, file->path, &st, 0) == 0
+	       && st.st_ino == file->st.st_ino && st.st_dev == file->st.st_dev
+	       && st.st_size == file->st.st_size
+	       && st.st_mtim.tv_sec == file->st.st_mtim.tv_sec
+	       && st.st_mtim.tv_nsec == file->st.st_mtim.tv_nsec;
+}
+
+static OpenFile* lookup(const char* path, unsigned long hash) {
+	pthread_mutex_lock(&mutex);
+	OpenFile* file = buckets[hash % bucket_count];
+	while(file != NULL && (file->hash != hash || strcmp(file->path, path) != 0)) {
+		file = file->chain;
+	}
+	if(file != NULL) {
+		atomic_fetch_add_explicit(&file->reference_count, 1, memory_order_relaxed);
+		if(file != head) {
+			file->prev->next = file->next;
+			if(file->next != NULL) {
+				file->next->prev = file->prev;
+			} else {
+				tail = file->prev;
+			}
+			push_front(file);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if(file != NULL && check_stat_on_hit && !still_current(file)) {
+		fd_cache_invalidate(path);
+		release(file);
+		return NULL;
+	}
+	return file;
+}
+
+/**
+ * @struct Opening
+ * @brief A file being opened and stat()ed on the DiskPool.
+ */
+typedef struct Opening {
+	const char* path;
+	int fd;                     // -1 on error
+	int error;
+	struct stat st;
+} Opening;
+
+static void open_and_stat(void* arg) {
+	Opening* o = arg;
+	o->fd = docroot_open(o->path, O_RDONLY);
+	if(o->fd >= 0 && fstat(o->fd, &o->st) < 0) {
+		o->error = errno;
+		close(o->fd);
+		o->fd = -1;
+		return;
+	}
+	o->error = errno;
+}
+
+OpenFile* fd_cache_open(const char* path) {
+	unsigned long hash = http_response_hash(path);
+	if(buckets != NULL) {
+		OpenFile* file = lookup(path, hash);
+		if(file != NULL) {
+			return file;
+		}
+	}
+
+	//Looking a file up may have to read directories and inodes from disk
+	unsigned long opened_at = atomic_load(&generation);
+	Opening opening = { path, -1, 0 };
+	disk_run(docroot_dev, open_and_stat, &opening);
+	if(opening.fd < 0) {
+		errno = opening.error;
+		return NULL;
+	}
+	int fd = opening.fd;
+	size_t len = strlen(path);
+	OpenFile* file = malloc(sizeof(OpenFile) + len + 1);
+	if(file == NULL || !S_ISREG(opening.st.st_mode)) {
+		int saved = file != NULL ? EISDIR : ENOMEM;
+		free(file);
+		close(fd);
+		errno = saved;
+		return NULL;
+	}
+	file->st = opening.st;
+	file->hash = hash;
+	file->fd = fd;
+	file->cached = 0;
+	memcpy(file->path, path, len + 1);
+	atomic_init(&file->reference_count, 1);
+	if(buckets == NULL) {
+		return file;
+	}
+
+	pthread_mutex_lock(&mutex);
+	//Someone else may have opened it meanwhile; keep theirs, use ours.
+	//And if anything was invalidated since we opened it, ours may be
+	//the old file: use it this once, but don't keep it.
+	OpenFile* other = buckets[hash % bucket_count];
+	while(other != NULL && (other->hash != hash || strcmp(other->path, path) != 0)) {
+		other = other->chain;
+	}
+	if(other == NULL && atomic_load(&generation) == opened_at) {
+		while(size >= capacity) {
+			remove_file_locked(tail);
+		}
+		atomic_fetch_add_explicit(&file->reference_count, 1, memory_order_relaxed);
+		file->cached = 1;
+		file->chain = buckets[hash % bucket_count];
+		buckets[hash % bucket_count] = file;
+		push_front(file);
+		size++;
+	}
+	pthread_mutex_unlock(&mutex);
+	return file;
+}
+
+void fd_cache_close(OpenFile* file) {
+	if(file != NULL) {
+		release(file);
+	}
+}
+
+void fd_cache_invalidate(const char* path) {
+	if(buckets == NULL) {
+		return;
+	}
+	unsigned long hash = http_response_hash(path);
+	pthread_mutex_lock(&mutex);
+	OpenFile* file = buckets[hash % bucket_count];
+	while(file != NULL && (file->hash != hash || strcmp(file->path, path) != 0)) {
+		file = file->chain;
+	}
+	if(file != NULL) {
+		remove_file_locked(file);
+	}
+	atomic_fetch_add(&generation, 1);
+	pthread_mutex_unlock(&mutex);
+}
+
+void fd_cache_clear(void) {
+	if(buckets == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	while(tail != NULL) {
+		remove_file_locked(tail);
+	}
+	atomic_fetch_add(&generation, 1);
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,92 @@
+/**
+ * @file FdCache.h
+ * @brief A table of open files, so a hot file isn't opened on every request.
+ *
+ * Every file is opened with openat2() relative to a descriptor held on
+ * the docroot, with RESOLVE_BENEATH so that not even a symlink leads
+ * out of it (plain openat() on kernels before 5.6), and with O_NOATIME
+ * where we own the file. Up to
+ * --fd-cache-entries of them are then kept open, along with their
+ * stat data, in least recently used order, so a file that is served
+ * often but can't be cached (too big, a range, a 304) costs no open(),
+ * fstat() or close() after the first time.
+ *
+ * Several threads may be reading the same descriptor at once, so it is
+ * only ever read at explicit offsets (pread(), sendfile()), and it is
+ * only closed once the last of them is done with it. The watcher drops
+ * a file as soon as it changes; without it, a hit is checked against
+ * stat().
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef FD_CACHE_H
+#define FD_CACHE_H
+
+#include <sys/stat.h>
+#include <stdatomic.h>
+
+/**
+ * @struct OpenFile
+ * @brief An open regular file in the docroot.
+ */
+typedef struct OpenFile {
+	struct OpenFile* prev;      // least recently used list
+	struct OpenFile* next;
+	struct OpenFile* chain;     // next in the same bucket
+	unsigned long hash;         // http_response_hash() of path
+	atomic_int reference_count; // one for the table, one for each user
+	int cached;                 // still in the table
+	int fd;
+	struct stat st;
+	char path[];
+} OpenFile;
+
+/**
+ * @brief Open the docroot and set up the table.
+ *
+ * Call after chdir() to the docroot. Until then, and with entries 0,
+ * files are still opened relative to the docroot but never kept open.
+ *
+ * @param entries The most files kept open at once.
+ * @param check_stat 1 to stat() the path on every hit, for when there is
+ *                   no watcher.
+ * @return 0 on success, -1 on error.
+ */
+int fd_cache_init(int entries, int check_stat);
+
+/**
+ * @brief open() a path relative to the docroot, without leaving it.
+ *
+ * O_NOATIME is added where the file allows it. Escaping the docroot
+ * fails with EXDEV.
+ *
+ * @return The descriptor, or -1 with errno set.
+ */
+int docroot_open(const char* path, int flags);
+
+/**
+ * @brief Get an open regular file.
+ *
+ * @return The file, to be passed back to fd_cache_close(), or NULL with
+ *         errno set (EISDIR for anything but a regular file).
+ */
+OpenFile* fd_cache_open(const char* path);
+
+/**
+ * @brief Finish with a file from fd_cache_open().
+ */
+void fd_cache_close(OpenFile* file);
+
+/**
+ * @brief Stop keeping a path open, because it changed.
+ */
+void fd_cache_invalidate(const char* path);
+
+/**
+ * @brief Stop keeping anything open.
+ */
+void fd_cache_clear(void);
+
+#endif
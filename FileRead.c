@@ -0,0 +1,134 @@
+/**
+ * @file FileRead.c
+ * @brief Sequential reads of files being streamed from disk.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "FileRead.h"
+#include "Config.h"
+#include "DiskPool.h"
+
+static long round_up(long n) {
+	return (n + FILE_READ_ALIGN - 1) / FILE_READ_ALIGN * FILE_READ_ALIGN;
+}
+
+/**
+ * @brief Read the first chunk only if the page cache has it.
+ *
+ * @return 1 if the file is cold, 0 if it isn't (what was read is left
+ *         in r->pending).
+ */
+static int is_cold(FileReader* r) {
+	struct iovec iov = { r->buf, r->buf_size };
+	for(;;) {
+		ssize_t n = preadv2(r->fd, &iov, 1, r->offset, RWF_NOWAIT);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n > 0) {
+			r->pending = n > r->end - r->offset ? r->end - r->offset : n;
+		}
+		//EOPNOTSUPP and the like: no way to tell, so leave it be
+		return n < 0 && errno == EAGAIN;
+	}
+}
+
+void file_reader_init(FileReader* r, const OpenFile* file, long offset, long end,
+                      char* scratch, size_t scratch_size) {
+	int fd = file->fd;
+	r->fd = fd;
+	r->dev = file->st.st_dev;
+	r->direct_fd = -1;
+	r->buf = scratch;
+	r->buf_size = scratch_size;
+	r->own_buf = 0;
+	r->offset = offset;
+	r->end = end;
+	r->pending = 0;
+
+	long len = end - offset;
+	if(len <= (long)scratch_size) {
+		return;
+	}
+	posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+
+	size_t size = round_up(len < config.read_buffer ? len : config.read_buffer);
+	void* buf;
+	if(posix_memalign(&buf, FILE_READ_ALIGN, size) != 0) {
+		return;
+	}
+	r->buf = buf;
+	r->buf_size = size;
+	r->own_buf = 1;
+
+	if(config.direct_io > 0 && len >= config.direct_io && offset % FILE_READ_ALIGN == 0 && is_cold(r)) {
+		//Fails on filesystems without O_DIRECT (e.g. tmpfs), which
+		//have no disk to bypass anyway
+		r->direct_fd = docroot_open(file->path, O_RDONLY | O_DIRECT);
+	}
+}
+
+ssize_t file_reader_next(FileReader* r, const char** chunk) {
+	*chunk = r->buf;
+	if(r->pending > 0) {
+		ssize_t n = r->pending;
+		r->pending = 0;
+		r->offset += n;
+		return n;
+	}
+
+	for(;;) {
+		long left = r->end - r->offset;
+		if(left <= 0) {
+			return 0;
+		}
+		ssize_t n;
+		if(r->direct_fd >= 0) {
+			//Whole aligned blocks; the last read just comes up short
+			n = disk_pread(r->direct_fd, r->dev, r->buf, r->buf_size, r->offset);
+			if(n < 0 && errno == EINVAL) {
+				//the device wants a larger alignment, go through the cache
+				close(r->direct_fd);
+				r->direct_fd = -1;
+				continue;
+			}
+		} else {
+			n = disk_pread(r->fd, r->dev, r->buf, left < (long)r->buf_size ? left : (long)r->buf_size, r->offset);
+		}
+		if(n > left) {
+			//the file grew since fstat()
+			n = left;
+		}
+		if(n > 0) {
+			r->offset += n;
+		}
+		return n;
+	}
+}
+
+void file_reader_close(FileReader* r) {
+	if(r->own_buf) {
+		free(r->buf);
+	}
+	if(r->direct_fd >= 0) {
+		close(r->direct_fd);
+	}
+}
+
+void file_will_read(int fd, long offset, long len) {
+	posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+}
+
+void file_prefetch(int fd, long len) {
+	readahead(fd, 0, len);
+}
@@ -0,0 +1,85 @@
+/**
+ * @file FileRead.h
+ * @brief Sequential reads of files being streamed from disk.
+ *
+ * A file that is streamed rather than cached is read in chunks of
+ * --read-buffer, into a page-aligned buffer of its own, with the kernel
+ * told up front that the whole range will be read in order, so its
+ * readahead runs well ahead of the sends.
+ *
+ * With --direct-io, a file at least that large whose start isn't in the
+ * page cache is taken to be cold and read with O_DIRECT instead, so
+ * streaming it once doesn't evict the hot files' pages. Whether it is
+ * cached is found out with a RWF_NOWAIT read, which fails rather than
+ * wait for the disk; a warm file keeps what that read got.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef FILE_READ_H
+#define FILE_READ_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include "FdCache.h"
+
+/* The alignment O_DIRECT needs of buffers, offsets and lengths. */
+#define FILE_READ_ALIGN 4096
+
+/**
+ * @struct FileReader
+ * @brief One file being read from start to end.
+ */
+typedef struct FileReader {
+	int fd;            // the shared descriptor the file was opened with
+	dev_t dev;         // its device, for the DiskPool
+	int direct_fd;     // our own O_DIRECT one, or -1
+	char* buf;
+	size_t buf_size;
+	int own_buf;       // buf is ours to free, rather than the caller's scratch
+	long offset;       // where the next read starts
+	long end;
+	ssize_t pending;   // bytes already in buf from the probe, or 0
+} FileReader;
+
+/**
+ * @brief Start reading [offset, end) of a file.
+ *
+ * @param file The file, only ever read at explicit offsets; its path is
+ *             used to reopen it with O_DIRECT.
+ * @param scratch Buffer to use for files it is big enough for.
+ * @param scratch_size The size of `scratch`.
+ */
+void file_reader_init(FileReader* r, const OpenFile* file, long offset, long end,
+                      char* scratch, size_t scratch_size);
+
+/**
+ * @brief Read the next chunk, on the DiskPool.
+ *
+ * @param chunk Set to the data, valid until the next call.
+ * @return The number of bytes read, 0 at the end, -1 on error.
+ */
+ssize_t file_reader_next(FileReader* r, const char** chunk);
+
+/**
+ * @brief Free what file_reader_init() set up. The file stays open.
+ */
+void file_reader_close(FileReader* r);
+
+/**
+ * @brief Tell the kernel that [offset, offset + len) is about to be read, in order.
+ *
+ * For files read whole, e.g. into the cache: the reads are started in
+ * the background straight away.
+ */
+void file_will_read(int fd, long offset, long len);
+
+/**
+ * @brief Pull a whole file into the page cache, for one known to be hot.
+ *
+ * Returns once the reads are queued, not once they are done.
+ */
+void file_prefetch(int fd, long len);
+
+#endif
@@ -0,0 +1,1105 @@
+/**
+ * @file Http.c
+ * @brief Request handling shared by every concurrency model.
+ *
+ * This is the one copy of what used to be handle_client_connection()
+ * in each of the four servers. The concurrency model decides where it
+ * runs; the cache backend decides what a hit costs.
+ *
+ * @author Dr. Jonathan Misurda
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <pthread.h>
+
+#include "Http.h"
+#include "Arena.h"
+#include "Stats.h"
+#include "Config.h"
+#include "Conditional.h"
+#include "Range.h"
+#include "Encoding.h"
+#include "Mime.h"
+#include "HttpDate.h"
+#include "Request.h"
+#include "NegativeCache.h"
+#include "FdCache.h"
+#include "Coro.h"
+#include "Timeout.h"
+#include "Admission.h"
+#include "ZeroCopy.h"
+#include "FileRead.h"
+#include "DiskPool.h"
+
+/* Smaller files gain too little from compression to be worth a variant. */
+#define COMPRESS_MIN_SIZE 256
+
+static pthread_key_t arena_key;
+
+static void free_arena(void* arena) {
+	arena_destroy(arena);
+	free(arena);
+}
+
+static void create_arena_key(void) {
+	pthread_key_create(&arena_key, free_arena);
+}
+
+long send_all(int connfd, const char* buf, long len) {
+	long total_sent = 0;
+	while(total_sent < len) {
+		//It's possible that send wasn't able to send all of
+		//our response in one call. It will return how much it
+		//actually sent. Keep calling send until all of it is
+		//sent, or the client goes away.
+		ssize_t sent = send(connfd, buf + total_sent, len - total_sent, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if(sent < 0 && errno == EAGAIN) {
+			//only on a coroutine's non-blocking socket
+			coro_wait(connfd, POLLOUT);
+			continue;
+		}
+		if(sent <= 0) {
+			break;
+		}
+		total_sent += sent;
+		connection_progress(connfd, sent);
+	}
+	return total_sent;
+}
+
+/**
+ * @brief Send every byte described by iov, retrying short sends.
+ *
+ * iov is modified as data goes out.
+ *
+ * @param flags Passed on to sendmsg(), e.g. MSG_MORE.
+ * @return The number of bytes sent, which is less than the total on error.
+ */
+static long sendv_all(int connfd, struct iovec* iov, int iovcnt, int flags) {
+	long total_sent = 0;
+	while(iovcnt > 0) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ssize_t sent = sendmsg(connfd, &msg, flags | MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if(sent < 0 && errno == EAGAIN) {
+			coro_wait(connfd, POLLOUT);
+			continue;
+		}
+		if(sent <= 0) {
+			break;
+		}
+		total_sent += sent;
+		connection_progress(connfd, sent);
+		//skip what went out, possibly stopping partway into a buffer
+		while(iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+			sent -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+	return total_sent;
+}
+
+/**
+ * @brief Render the part of the response head that changes per request.
+ *
+ * That is the status line and the Date header.
+ *
+ * @param status The status code and reason, e.g. "200 OK".
+ * @return The length written to out.
+ */
+static int render_status(char* out, size_t size, const char* status) {
+	//Formatted once a second and shared, see HttpDate.c
+	char date[HTTP_DATE_SIZE];
+	http_date_now(date);
+	return snprintf(out, size, "HTTP/1.1 %s\r\nDate: %s\r\n", status, date);
+}
+
+/**
+ * @struct Representation
+ * @brief What the headers say about the body being sent.
+ *
+ * Built from fstat() on a miss and from the HttpResponse on a hit, so
+ * both paths render the same headers.
+ */
+typedef struct Representation {
+	const char* filename;     // the requested name, for the stats log
+	long size;                // of the (possibly encoded) body
+	time_t mtime;
+	ContentEncoding encoding;
+	const char* content_type;
+	char etag[ETAG_SIZE];
+} Representation;
+
+static void describe_file(Representation* rep, const char* filename, ContentEncoding encoding,
+                          const struct stat* file_stats, long size) {
+	rep->filename = filename;
+	rep->size = size;
+	rep->mtime = file_stats->st_mtime;
+	rep->encoding = encoding;
+	rep->content_type = mime_type(filename);
+	format_etag(rep->etag, sizeof(rep->etag), file_stats->st_ino, size, file_stats->st_mtime,
+	            encoding == ENCODING_IDENTITY ? NULL : encoding_name(encoding));
+}
+
+static void describe_response(Representation* rep, const HttpResponse* resp) {
+	rep->filename = http_response_key(resp);
+	rep->size = resp->filesize;
+	rep->mtime = resp->mtime;
+	rep->encoding = resp->encoding;
+	rep->content_type = resp->content_type;
+	format_etag(rep->etag, sizeof(rep->etag), resp->ino, resp->filesize, resp->mtime,
+	            resp->encoding == ENCODING_IDENTITY ? NULL : encoding_name(resp->encoding));
+}
+
+/**
+ * @brief Render the headers every response about rep repeats.
+ *
+ * @return The length written to out.
+ */
+static int render_validators(char* out, size_t size, const Representation* rep) {
+	char last_modified[HTTP_DATE_SIZE];
+	format_http_date(last_modified, sizeof(last_modified), rep->mtime);
+	int len = snprintf(out, size,
+		"ETag: %s\r\n"
+		"Last-Modified: %s\r\n"
+		//caches must keep the encodings of a file apart
+		"Vary: Accept-Encoding\r\n",
+		rep->etag, last_modified);
+	if(rep->encoding != ENCODING_IDENTITY) {
+		len += snprintf(out + len, size - len, "Content-Encoding: %s\r\n", encoding_name(rep->encoding));
+	}
+	return len;
+}
+
+/**
+ * @brief Render the rest of the headers and the blank line.
+ *
+ * These only depend on the file, so cached responses keep theirs.
+ *
+ * @return The length written to out.
+ */
+static int render_header_block(char* out, size_t size, const Representation* rep) {
+	int len = snprintf(out, size,
+		"Content-Length: %ld\r\n"
+		"Accept-Ranges: bytes\r\n",
+		rep->size);
+	len += render_validators(out + len, size - len, rep);
+	len += snprintf(out + len, size - len,
+		//Tell the client we won't reuse this connection for other files
+		"Connection: close\r\n"
+		//Send our MIME type and a blank line
+		"Content-Type: %s\r\n\r\n",
+		rep->content_type);
+	return len;
+}
+
+/**
+ * @struct Transfer
+ * @brief The rest of a body, for the steal model to send a slice at a time.
+ */
+struct Transfer {
+	int connfd;
+	HttpResponse* resp;      // a reference to the cached response the body is in, or
+	OpenFile* file;          // the file to sendfile() it from
+	long offset;             // of the next byte to send
+	long end;                // of the body
+	long sent;               // body bytes sent so far, for the stats log
+	struct timespec cpu;     // spent on it so far, by whichever threads
+	char filename[];
+};
+
+/**
+ * @brief Leave the rest of a body for transfer_continue().
+ *
+ * On success the transfer owns a reference to resp or to file.
+ *
+ * @return The transfer, or NULL if it could not be allocated.
+ */
+static Transfer* defer_body(int connfd, const char* filename, HttpResponse* resp, OpenFile* file,
+                            long offset, long end, const struct timespec* start) {
+	size_t len = strlen(filename);
+	Transfer* t = malloc(sizeof(Transfer) + len + 1);
+	if(t == NULL) {
+		return NULL;
+	}
+	t->connfd = connfd;
+	t->resp = resp;
+	t->file = file;
+	t->offset = offset;
+	t->end = end;
+	t->sent = offset;
+	t->cpu = (struct timespec){ 0, 0 };
+	stats_add(&t->cpu, start);
+	memcpy(t->filename, filename, len + 1);
+	if(resp != NULL) {
+		pick_up(resp);
+	}
+	//However long it waits in a deque is not the client's fault; the
+	//deadline is armed again when the next slice goes out
+	connection_forget(connfd);
+	return t;
+}
+
+/**
+ * @brief Send a cached HTTP response.
+ *
+ * The header block and the body are contiguous in the cache entry, so
+ * the whole response is two buffers handed to a single sendmsg().
+ * Bodies of --zerocopy-min or more go out separately, lent to the
+ * kernel rather than copied, see ZeroCopy.h.
+ *
+ * @param connfd The client socket descriptor.
+ * @param http_response The cached response.
+ * @param rest Where to leave the rest of a large body, or NULL to send it all.
+ * @return The number of body bytes sent to connfd.
+ */
+static long send_existing_http_response(int connfd, HttpResponse* http_response, Transfer** rest) {
+	struct timespec start;
+	stats_start(&start);
+
+	long body_len = http_response->filesize;
+	if(rest != NULL && body_len > config.steal_slice) {
+		body_len = config.steal_slice;
+	}
+
+	char status[128];
+	struct iovec iov[2];
+	iov[0].iov_base = status;
+	iov[0].iov_len = render_status(status, sizeof(status), "200 OK");
+	iov[1].iov_base = (char*)http_response_headers(http_response);
+	//Only whole bodies: a slice's wait for acknowledgement would hold
+	//up the worker it is meant to free. Nor from the pq cache, whose
+	//lock is held until the hit is released: one slow reader would
+	//stall every other hit.
+	int lend = config.zerocopy_min > 0 && body_len >= config.zerocopy_min
+	           && body_len == (long)http_response->filesize && config.cache != CACHE_PQ;
+	iov[1].iov_len = http_response->header_len + (lend ? 0 : body_len);
+
+	long head = iov[0].iov_len + http_response->header_len;
+	long sent = sendv_all(connfd, iov, 2, lend ? MSG_MORE : 0);
+	long total_sent = sent > head ? sent - head : 0;
+	if(lend && sent == head) {
+		total_sent = zerocopy_send_all(connfd, http_response_body(http_response), body_len);
+	}
+
+	if(total_sent == body_len && body_len < (long)http_response->filesize) {
+		*rest = defer_body(connfd, http_response_key(http_response), http_response, NULL,
+		                   body_len, http_response->filesize, &start);
+		if(*rest != NULL) {
+			return total_sent;
+		}
+		total_sent += send_all(connfd, http_response_body(http_response) + body_len,
+		                       http_response->filesize - body_len);
+	}
+
+	stats_log(http_response_key(http_response), total_sent, &start);
+	return total_sent;
+}
+
+/**
+ * @brief Send the response head for a file that is about to be streamed.
+ *
+ * @return 0 on success, -1 if the client went away.
+ */
+static int send_head(int connfd, const char* block, int block_len) {
+	char status[128];
+	struct iovec iov[2];
+	iov[0].iov_base = status;
+	iov[0].iov_len = render_status(status, sizeof(status), "200 OK");
+	iov[1].iov_base = (char*)block;
+	iov[1].iov_len = block_len;
+	long len = iov[0].iov_len + iov[1].iov_len;
+	return sendv_all(connfd, iov, 2, 0) == len ? 0 : -1;
+}
+
+/**
+ * @brief Tell the client its copy is still good.
+ *
+ * A 304 repeats the validators but has no body.
+ */
+static void send_not_modified(int connfd, const Representation* rep) {
+	struct timespec start;
+	stats_start(&start);
+
+	char head[512];
+	int len = render_status(head, sizeof(head), "304 Not Modified");
+	len += render_validators(head + len, sizeof(head) - len, rep);
+	len += snprintf(head + len, sizeof(head) - len, "Connection: close\r\n\r\n");
+	send_all(connfd, head, len);
+
+	stats_log(rep->filename, 0, &start);
+}
+
+/**
+ * @brief Send part of a body, from memory or from a file.
+ *
+ * @param body The whole body, or NULL to send from fd.
+ * @param fd The file to sendfile() from when body is NULL.
+ * @return The number of bytes sent.
+ */
+static long send_body_range(int connfd, const char* body, int fd, long offset, long len) {
+	if(body != NULL) {
+		return send_all(connfd, body + offset, len);
+	}
+
+	//sendfile() takes its own offset, so the file position doesn't matter
+	off_t off = offset;
+	long total_sent = 0;
+	while(total_sent < len) {
+		ssize_t sent = sendfile(connfd, fd, &off, len - total_sent);
+		if(sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if(sent < 0 && errno == EAGAIN) {
+			coro_wait(connfd, POLLOUT);
+			continue;
+		}
+		if(sent <= 0) {
+			break;
+		}
+		total_sent += sent;
+		connection_progress(connfd, sent);
+	}
+	return total_sent;
+}
+
+/**
+ * @brief Render the head of one part of a multipart/byteranges body.
+ *
+ * @return The length of the part head, even if it didn't fit in out.
+ */
+static int render_part_head(char* out, size_t size, const char* boundary,
+                            const ByteRange* range, const Representation* rep) {
+	return snprintf(out, size,
+		"\r\n--%s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Range: bytes %ld-%ld/%ld\r\n\r\n",
+		boundary, rep->content_type, range->first, range->last, rep->size);
+}
+
+/**
+ * @brief Send a 206 with the requested ranges of a body.
+ *
+ * One range is sent as is, with a Content-Range header. Several are
+ * sent as a multipart/byteranges body, each part with its own. Ranges
+ * of an encoded body are ranges of the encoded bytes.
+ *
+ * @param connfd The client socket descriptor.
+ * @param rep The body the ranges are of.
+ * @param ranges The ranges from request_ranges().
+ * @param count How many there are.
+ * @param body The cached body, or NULL to send from fd.
+ * @param fd The open file when there is no cached body.
+ */
+static void send_partial_content(int connfd, const Representation* rep, const ByteRange* ranges, int count,
+                                 const char* body, int fd) {
+	struct timespec start;
+	stats_start(&start);
+
+	char head[768];
+	int len = render_status(head, sizeof(head), "206 Partial Content");
+	char boundary[40];
+	if(count == 1) {
+		len += snprintf(head + len, sizeof(head) - len,
+			"Content-Length: %ld\r\n"
+			"Content-Range: bytes %ld-%ld/%ld\r\n"
+			"Content-Type: %s\r\n",
+			ranges[0].last - ranges[0].first + 1,
+			ranges[0].first, ranges[0].last, rep->size, rep->content_type);
+	} else {
+		//The boundary only has to not appear in the parts
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(boundary, sizeof(boundary), "%016lx%08lx",
+		         http_response_hash(rep->etag) ^ (unsigned long)now.tv_sec,
+		         (unsigned long)now.tv_nsec);
+
+		long content_length = snprintf(NULL, 0, "\r\n--%s--\r\n", boundary);
+		for(int i = 0; i < count; i++) {
+			content_length += render_part_head(NULL, 0, boundary, &ranges[i], rep);
+			content_length += ranges[i].last - ranges[i].first + 1;
+		}
+		len += snprintf(head + len, sizeof(head) - len,
+			"Content-Length: %ld\r\n"
+			"Content-Type: multipart/byteranges; boundary=%s\r\n",
+			content_length, boundary);
+	}
+	len += render_validators(head + len, sizeof(head) - len, rep);
+	len += snprintf(head + len, sizeof(head) - len, "Connection: close\r\n\r\n");
+
+	long sent = 0;
+	if(send_all(connfd, head, len) == len) {
+		for(int i = 0; i < count; i++) {
+			long range_len = ranges[i].last - ranges[i].first + 1;
+			if(count > 1) {
+				char part[256];
+				int part_len = render_part_head(part, sizeof(part), boundary, &ranges[i], rep);
+				if(send_all(connfd, part, part_len) < part_len) {
+					break;
+				}
+			}
+			long n = send_body_range(connfd, body, fd, ranges[i].first, range_len);
+			sent += n;
+			if(n < range_len) {
+				break;
+			}
+		}
+		if(count > 1) {
+			char tail[64];
+			int tail_len = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+			send_all(connfd, tail, tail_len);
+		}
+	}
+
+	stats_log(rep->filename, sent, &start);
+}
+
+/**
+ * @brief Send a 416: none of the requested ranges exist.
+ */
+static void send_range_not_satisfiable(int connfd, const Representation* rep) {
+	struct timespec start;
+	stats_start(&start);
+
+	char head[256];
+	int len = render_status(head, sizeof(head), "416 Range Not Satisfiable");
+	len += snprintf(head + len, sizeof(head) - len,
+		"Content-Range: bytes */%ld\r\n"
+		"Content-Length: 0\r\n"
+		"Connection: close\r\n\r\n",
+		rep->size);
+	send_all(connfd, head, len);
+
+	stats_log(rep->filename, 0, &start);
+}
+
+/**
+ * @brief Answer a conditional or range request, if this is one.
+ *
+ * @param body The body in memory, or NULL to send ranges from fd.
+ * @return 1 if a 304, 206 or 416 was sent, 0 if the request wants a 200.
+ */
+static int send_conditional(int connfd, const char* request, const Representation* rep,
+                            const char* body, int fd) {
+	//Most repeat requests are revalidations, which need no body at all
+	if(request_not_modified(request, rep->etag, rep->mtime)) {
+		send_not_modified(connfd, rep);
+		return 1;
+	}
+
+	ByteRange ranges[MAX_RANGES];
+	int range_count = request_ranges(request, rep->etag, rep->mtime, rep->size, ranges);
+	if(range_count < 0) {
+		send_range_not_satisfiable(connfd, rep);
+		return 1;
+	}
+	if(range_count > 0) {
+		send_partial_content(connfd, rep, ranges, range_count, body, fd);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Answer a request from a cache entry.
+ */
+static void send_cached(int connfd, const char* request, HttpResponse* resp, Transfer** rest) {
+	Representation rep;
+	describe_response(&rep, resp);
+	if(!send_conditional(connfd, request, &rep, http_response_body(resp), -1)) {
+		send_existing_http_response(connfd, resp, rest);
+	}
+}
+
+/**
+ * @brief Read a file into a new HttpResponse while sending it.
+ *
+ * Each chunk is sent as soon as it is read, so the client doesn't wait
+ * for the whole file. If the entry can't be allocated the file is still
+ * sent, it just isn't cached.
+ *
+ * @param connfd The client socket descriptor.
+ * @param fd The open file, read at explicit offsets since it may be shared.
+ * @param rep What is being sent.
+ * @param file_stats From fstat() on fd.
+ * @param response Scratch space for when there is no cached body to read into.
+ * @param response_size The size of `response`.
+ * @param sent Set to the number of body bytes sent.
+ * @return The new HttpResponse, or NULL if it could not be built.
+ */
+static HttpResponse* send_and_read_file(int connfd, int fd, const Representation* rep,
+                                        const struct stat* file_stats,
+                                        char* response, size_t response_size, long* sent) {
+	long filesize = rep->size;
+	char block[512];
+	int block_len = render_header_block(block, sizeof(block), rep);
+
+	HttpResponse* new = create_http_response(rep->filename, rep->encoding, rep->content_type, file_stats,
+	                                         block, block_len, filesize);
+	if(new == NULL) {
+		perror("could not allocate memory for new cached page");
+	}
+
+	*sent = 0;
+	if(send_head(connfd, block, block_len) < 0) {
+		put_down(new);
+		return NULL;
+	}
+
+	char* body = new != NULL ? http_response_writable_body(new) : NULL;
+	if(body != NULL) {
+		file_will_read(fd, 0, filesize);
+	}
+	long total_read = 0;
+	for(;;) {
+		//read straight into the cached body if we have one, a
+		//--read-buffer at a time. Never read past the size we
+		//allocated for, in case the file grew since fstat().
+		char* chunk = body != NULL ? body + total_read : response;
+		size_t want = body != NULL ? (size_t)config.read_buffer : response_size;
+		if(body != NULL && total_read + (long)want > filesize) {
+			want = filesize - total_read;
+		}
+		if(want == 0) {
+			break;
+		}
+		ssize_t bytes_read = disk_pread(fd, file_stats->st_dev, chunk, want, total_read);
+		if(bytes_read <= 0) {
+			break;
+		}
+		total_read += bytes_read;
+
+		//if we read anything, send it
+		long n = send_all(connfd, chunk, bytes_read);
+		*sent += n;
+		if(n < bytes_read) {
+			//the client went away, so what we have is incomplete
+			put_down(new);
+			return NULL;
+		}
+	}
+
+	if(new != NULL && total_read != filesize) {
+		//the file changed under us, don't cache what we got
+		put_down(new);
+		return NULL;
+	}
+	return new;
+}
+
+/**
+ * @brief The connection arena of the calling thread, or coroutine.
+ *
+ * Created on first use and freed when the thread exits, so pool workers
+ * reuse one arena for every connection they serve. The coroutines on
+ * one thread take turns mid-connection, so each has its own, kept
+ * along with its stack.
+ */
+static Arena* worker_arena(void) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	void** coro_slot = coro_local();
+	Arena* arena;
+
+	pthread_once(&once, create_arena_key);
+	arena = coro_slot != NULL ? *coro_slot : pthread_getspecific(arena_key);
+	if(arena == NULL) {
+		arena = malloc(sizeof(Arena));
+		if(arena == NULL) {
+			return NULL;
+		}
+		// enough for the request and a read buffer
+		arena_init(arena, config.recv_buffer_size * 2 + config.io_buffer_size + 256);
+		if(coro_slot != NULL) {
+			*coro_slot = arena;
+		} else {
+			pthread_setspecific(arena_key, arena);
+		}
+	}
+	return arena;
+}
+
+
+/**
+ * @brief Send a file from disk, caching it on the way if the cache admits it.
+ *
+ * @param connfd The client socket descriptor.
+ * @param cache The response cache, or NULL.
+ * @param request The request, for conditional and range headers.
+ * @param filename The requested filename, which is the cache key.
+ * @param path The file to send: filename, or a precompressed sibling.
+ * @param encoding How the file at path is encoded.
+ * @param response Scratch space for reading the file.
+ * @param response_size The size of `response`.
+ * @param rest Where to leave the rest of a large uncached body, or NULL.
+ * @return 0 if a response was sent, -1 if path could not be opened.
+ */
+static int serve_file(int connfd, Cache* cache, const char* request, const char* filename,
+                      const char* path, ContentEncoding encoding,
+                      char* response, size_t response_size, Transfer** rest) {
+	//The open file comes with its stat data, and is likely still open
+	//from an earlier request
+	OpenFile* file = fd_cache_open(path);
+	if(file == NULL) {
+		return -1;
+	}
+	const struct stat* file_stats = &file->st;
+
+	Representation rep;
+	describe_file(&rep, filename, encoding, file_stats, file_stats->st_size);
+
+	//A 304 or partial response is sent straight from the file and not cached
+	if(send_conditional(connfd, request, &rep, NULL, file->fd)) {
+		fd_cache_close(file);
+		return 0;
+	}
+
+	struct timespec start;
+	stats_start(&start);
+
+	//Files too big to cache, or not yet missed often enough, stream past it
+	long sent = 0;
+	if(cache != NULL && cache_admits(cache, filename, file_stats->st_size)) {
+		HttpResponse* new = send_and_read_file(connfd, file->fd, &rep, file_stats,
+		                                       response, response_size, &sent);
+		if(new != NULL) {
+			cache_insert(cache, new);
+			put_down(new);
+		}
+	} else {
+		char block[512];
+		int block_len = render_header_block(block, sizeof(block), &rep);
+		if(send_head(connfd, block, block_len) == 0) {
+			long size = file_stats->st_size;
+			if(rest != NULL && size > config.steal_slice) {
+				//The first slice now, the rest whenever a worker gets to it
+				sent = send_body_range(connfd, NULL, file->fd, 0, config.steal_slice);
+				if(sent < config.steal_slice) {
+					//The client is gone, so the rest is not worth reading
+					stats_log(filename, sent, &start);
+					fd_cache_close(file);
+					return 0;
+				}
+				*rest = defer_body(connfd, filename, NULL, file, sent, size, &start);
+				if(*rest != NULL) {
+					return 0;
+				}
+			}
+			FileReader reader;
+			file_reader_init(&reader, file, sent, size, response, response_size);
+			const char* chunk;
+			ssize_t bytes_read;
+			while((bytes_read = file_reader_next(&reader, &chunk)) > 0) {
+				long n = send_all(connfd, chunk, bytes_read);
+				sent += n;
+				if(n < bytes_read) {
+					break;
+				}
+			}
+			file_reader_close(&reader);
+		}
+	}
+
+	stats_log(filename, sent, &start);
+	fd_cache_close(file);
+	return 0;
+}
+
+int preload_file(Cache* cache, const char* filename) {
+	HttpResponse* existing_response = cache_lookup(cache, filename, ENCODING_IDENTITY);
+	if(existing_response != NULL) {
+		cache_release(cache, existing_response);
+		return 0;
+	}
+
+	//Not through the fd cache, which would be flushed by a warm-up
+	int fd = docroot_open(filename, O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	struct stat file_stats;
+	if(fstat(fd, &file_stats) < 0 || !S_ISREG(file_stats.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	if(!cache_fits(cache, file_stats.st_size)) {
+		//It will be streamed from disk; at least have it in memory there
+		file_prefetch(fd, file_stats.st_size);
+		close(fd);
+		return -1;
+	}
+
+	Representation rep;
+	describe_file(&rep, filename, ENCODING_IDENTITY, &file_stats, file_stats.st_size);
+	char block[512];
+	int block_len = render_header_block(block, sizeof(block), &rep);
+	HttpResponse* new = create_http_response(filename, ENCODING_IDENTITY, rep.content_type, &file_stats,
+	                                         block, block_len, file_stats.st_size);
+	if(new == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	//no one is waiting on this one, so read it in one go
+	long total_read = 0;
+	while(total_read < file_stats.st_size) {
+		ssize_t n = pread(fd, http_response_writable_body(new) + total_read,
+		                  file_stats.st_size - total_read, total_read);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		total_read += n;
+	}
+	close(fd);
+	int ret = -1;
+	if(total_read == file_stats.st_size && cache_insert(cache, new)) {
+		ret = 0;
+	}
+	put_down(new);
+	return ret;
+}
+
+/**
+ * @brief Compress a file, send it and cache the result.
+ *
+ * Only called with a cache, so each file is compressed once rather than
+ * once per request.
+ *
+ * @return 0 if a response was sent, -1 if the file isn't worth
+ *         compressing (too small, too big, or it didn't shrink).
+ */
+static int serve_compressed(int connfd, Cache* cache, const char* request,
+                            const char* filename, ContentEncoding encoding, Transfer** rest) {
+	OpenFile* file = fd_cache_open(filename);
+	if(file == NULL) {
+		return -1;
+	}
+	struct stat file_stats = file->st;
+	if(file_stats.st_size < COMPRESS_MIN_SIZE || file_stats.st_size > config.compress_max) {
+		fd_cache_close(file);
+		return -1;
+	}
+
+	long filesize = file_stats.st_size;
+	long bound = encoding_bound(encoding, filesize);
+	char* in = malloc(filesize);
+	char* out = bound > 0 ? malloc(bound) : NULL;
+	long total_read = 0;
+	while(in != NULL && total_read < filesize) {
+		ssize_t n = disk_pread(file->fd, file_stats.st_dev, in + total_read, filesize - total_read, total_read);
+		if(n <= 0) {
+			break;
+		}
+		total_read += n;
+	}
+	fd_cache_close(file);
+
+	long compressed = -1;
+	if(in != NULL && out != NULL && total_read == filesize) {
+		compressed = encoding_compress(encoding, in, filesize, out, bound);
+	}
+	free(in);
+	if(compressed < 0 || compressed >= filesize) {
+		free(out);
+		return -1;
+	}
+
+	Representation rep;
+	describe_file(&rep, filename, encoding, &file_stats, compressed);
+	char block[512];
+	int block_len = render_header_block(block, sizeof(block), &rep);
+	HttpResponse* new = create_http_response(filename, encoding, rep.content_type, &file_stats,
+	                                         block, block_len, compressed);
+	if(new == NULL) {
+		perror("could not allocate memory for new cached page");
+		free(out);
+		return -1;
+	}
+	memcpy(http_response_writable_body(new), out, compressed);
+	free(out);
+
+	send_cached(connfd, request, new, rest);
+	cache_insert(cache, new);
+	put_down(new);
+	return 0;
+}
+
+/**
+ * @brief Send a compressed variant of a file, if the client takes one.
+ *
+ * In order: a cached variant, a precompressed sibling on disk, and
+ * finally compressing the file now. Within each step the best encoding
+ * the client accepts wins.
+ *
+ * @param accepted The encodings the client accepts, from accepted_encodings().
+ * @return 0 if a response was sent, -1 to send the identity instead.
+ */
+static int serve_variant(int connfd, Cache* cache, const char* request, const char* filename,
+                         int accepted, Arena* arena, char* response, size_t response_size,
+                         Transfer** rest) {
+	int e;
+	if(cache != NULL) {
+		for(e = ENCODING_COUNT - 1; e > ENCODING_IDENTITY; e--) {
+			if(!(accepted & (1 << e))) {
+				continue;
+			}
+			HttpResponse* existing_response = cache_lookup(cache, filename, e);
+			if(existing_response != NULL) {
+				send_cached(connfd, request, existing_response, rest);
+				cache_release(cache, existing_response);
+				return 0;
+			}
+		}
+	}
+
+	size_t len = strlen(filename);
+	char* path = arena_alloc(arena, len + 4);
+	if(path == NULL) {
+		return -1;
+	}
+	for(e = ENCODING_COUNT - 1; e > ENCODING_IDENTITY; e--) {
+		if(!(accepted & (1 << e))) {
+			continue;
+		}
+		memcpy(path, filename, len);
+		strcpy(path + len, encoding_suffix(e));
+		//Most files have no precompressed sibling; don't look every time
+		if(negative_cache_lookup(path)) {
+			continue;
+		}
+		if(serve_file(connfd, cache, request, filename, path, e, response, response_size, rest) == 0) {
+			return 0;
+		}
+		if(errno == ENOENT || errno == ENOTDIR) {
+			negative_cache_insert(path);
+		}
+	}
+
+	if(cache == NULL || !config.compress) {
+		return -1;
+	}
+	for(e = ENCODING_COUNT - 1; e > ENCODING_IDENTITY; e--) {
+		if(accepted & (1 << e)) {
+			return serve_compressed(connfd, cache, request, filename, e, rest);
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Send an error with no body, such as a 404.
+ *
+ * Everything but the status and the Date is fixed, so it is prebuilt.
+ */
+static void send_no_body(int connfd, char* buffer, size_t buffer_size, const char* status) {
+	static const char tail[] = "Content-Length: 0\r\nConnection: close\r\n\r\n";
+	int len = render_status(buffer, buffer_size, status);
+	if(len + sizeof(tail) - 1 <= buffer_size) {
+		memcpy(buffer + len, tail, sizeof(tail) - 1);
+		send_all(connfd, buffer, len + sizeof(tail) - 1);
+	}
+}
+
+void send_unavailable(int connfd) {
+	static const char tail[] = "Retry-After: 1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	char buffer[256];
+	int len = render_status(buffer, sizeof(buffer), "503 Service Unavailable");
+	if(len + sizeof(tail) - 1 <= sizeof(buffer)) {
+		memcpy(buffer + len, tail, sizeof(tail) - 1);
+		//A new connection's send buffer is empty, so this fits
+		send(connfd, buffer, len + sizeof(tail) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+}
+
+/**
+ * @brief Drop a finished connection's deadline and place, and close it.
+ */
+static void close_connection(int connfd) {
+	connection_forget(connfd);
+	admission_leave(connfd);
+	shutdown(connfd, SHUT_RDWR);
+	close(connfd);
+}
+
+/**
+ * @brief Read the request and send the response.
+ *
+ * @param connfd The client socket descriptor.
+ * @param cache The response cache, or NULL.
+ * @param arena Where this connection's buffers come from.
+ * @param rest Where to leave the rest of a large body, or NULL to send it all.
+ */
+static void serve_request(int connfd, Cache* cache, Arena* arena, Transfer** rest) {
+	size_t buffer_size = config.recv_buffer_size;
+	size_t response_size = config.io_buffer_size;
+	char* buffer = arena_alloc(arena, buffer_size);
+	char* filename = arena_alloc(arena, buffer_size);
+	char* response = arena_alloc(arena, response_size);
+	if(buffer == NULL || filename == NULL || response == NULL) {
+		perror("could not allocate connection buffers");
+		return;
+	}
+	//In HTTP, the client speaks first. So we recv their message
+	//into our buffer. Leave room for the terminator.
+	int amt;
+	while((amt = recv(connfd, buffer, buffer_size - 1, 0)) < 0 && (errno == EINTR || errno == EAGAIN)) {
+		if(errno == EAGAIN) {
+			coro_wait(connfd, POLLIN);
+		}
+	}
+	if(amt > 0) {
+		buffer[amt] = '\0';
+	}
+	connection_start_sending(connfd);
+
+	//We only can handle HTTP GET requests for files served
+	//from the current working directory, which becomes the website root
+	if(amt <= 0 || sscanf(buffer, "GET /%s", filename) < 1) {
+		fprintf(stderr, "Bad HTTP request\n");
+		return;
+	}
+
+	//The path as sent may have escapes, dot segments or doubled slashes;
+	//the normalized one is what we open and what the cache is keyed by
+	if(normalize_path(filename) < 0) {
+		send_no_body(connfd, buffer, buffer_size, "400 Bad Request");
+		return;
+	}
+
+	//If the HTTP request is bigger than our buffer can hold, we need to call
+	//recv() until we have no more data to read, otherwise it will be
+	//there waiting for us on the next call to recv(). So we'll just
+	//read it and discard it. GET should be the first 3 bytes, and we'll
+	//assume paths that are smaller than about the buffer size.
+	if(amt == buffer_size - 1)
+	{
+		//if recv returns as much as we asked for, there may be more data.
+		//Discard it into the read buffer so the headers we did get survive.
+		while(recv(connfd, response, response_size, MSG_DONTWAIT) == response_size)
+			/* discard */;
+	}
+
+	//A path we already know is missing costs no open(), not even of
+	//its compressed siblings
+	if(negative_cache_lookup(filename)) {
+		send_no_body(connfd, buffer, buffer_size, "404 Not Found");
+		return;
+	}
+
+	//Text files go out compressed to clients that take it
+	if(encoding_compressible(filename)) {
+		int accepted = accepted_encodings(buffer);
+		if(accepted != 0 && serve_variant(connfd, cache, buffer, filename, accepted,
+		                                  arena, response, response_size, rest) == 0) {
+			return;
+		}
+	}
+
+	// Search the cache for an existing response
+	if(cache != NULL) {
+		HttpResponse* existing_response = cache_lookup(cache, filename, ENCODING_IDENTITY);
+		if(existing_response != NULL) {
+			send_cached(connfd, buffer, existing_response, rest);
+			cache_release(cache, existing_response);
+			return;
+		}
+	}
+
+	if(serve_file(connfd, cache, buffer, filename, filename, ENCODING_IDENTITY,
+	              response, response_size, rest) < 0) {
+		//Assume that failure to open the file means it doesn't exist,
+		//but only remember it if it really doesn't (not e.g. EMFILE)
+		if(errno == ENOENT || errno == ENOTDIR) {
+			negative_cache_insert(filename);
+		}
+		send_no_body(connfd, buffer, buffer_size, "404 Not Found");
+	}
+}
+
+void handle_client_connection(int connfd, Cache* cache) {
+	//At this point a client has connected. The remainder of the
+	//protocol is handling the client's GET request and producing
+	//our response.
+	Arena* arena = worker_arena();
+	connection_expect_request(connfd);
+	if(arena != NULL) {
+		serve_request(connfd, cache, arena, NULL);
+		arena_reset(arena);
+	} else {
+		perror("could not allocate connection arena");
+	}
+	close_connection(connfd);
+}
+
+Transfer* handle_client_slice(int connfd, Cache* cache) {
+	Transfer* rest = NULL;
+	Arena* arena = worker_arena();
+	connection_expect_request(connfd);
+	if(arena != NULL) {
+		serve_request(connfd, cache, arena, &rest);
+		//the transfer holds nothing from the arena
+		arena_reset(arena);
+	} else {
+		perror("could not allocate connection arena");
+	}
+	if(rest == NULL) {
+		close_connection(connfd);
+	}
+	return rest;
+}
+
+Transfer* transfer_continue(Transfer* t) {
+	long len = t->end - t->offset;
+	if(len > config.steal_slice) {
+		len = config.steal_slice;
+	}
+	struct timespec start;
+	stats_start(&start);
+	connection_start_sending(t->connfd);
+	const char* body = t->resp != NULL ? http_response_body(t->resp) : NULL;
+	long n = send_body_range(t->connfd, body, t->file != NULL ? t->file->fd : -1, t->offset, len);
+	t->offset += n;
+	t->sent += n;
+	stats_add(&t->cpu, &start);
+	if(n == len && t->offset < t->end) {
+		connection_forget(t->connfd);
+		return t;
+	}
+
+	//done, or the client went away
+	stats_log_total(t->filename, t->sent, &t->cpu);
+	put_down(t->resp);
+	fd_cache_close(t->file);
+	close_connection(t->connfd);
+	free(t);
+	return NULL;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file Http.h
+ * @brief Request handling shared by every concurrency model.
+ *
+ * @author Dr. Jonathan Misurda
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include "Cache.h"
+
+/**
+ * @brief Serve one request on a connected socket, then close it.
+ *
+ * @param connfd The client socket descriptor.
+ * @param cache The response cache, or NULL.
+ */
+void handle_client_connection(int connfd, Cache* cache);
+
+/**
+ * @brief The part of a response still to be sent, see handle_client_slice().
+ */
+typedef struct Transfer Transfer;
+
+/**
+ * @brief Serve one request, but only the first --steal-slice bytes of a large body.
+ *
+ * Only 200s with a cached body or an uncached file are sliced; anything
+ * else is sent whole, as by handle_client_connection().
+ *
+ * @param connfd The client socket descriptor.
+ * @param cache The response cache, or NULL.
+ * @return NULL once the connection is done and closed, otherwise the
+ *         rest of the body, to be passed to transfer_continue().
+ */
+Transfer* handle_client_slice(int connfd, Cache* cache);
+
+/**
+ * @brief Send the next slice of a transfer.
+ *
+ * Any thread may continue a transfer, one at a time.
+ *
+ * @return NULL once the connection is done and closed, otherwise t.
+ */
+Transfer* transfer_continue(Transfer* t);
+
+/**
+ * @brief Read a file into the cache without serving it.
+ *
+ * Used to warm the cache up; does nothing if the file is already cached.
+ *
+ * @param cache The cache to fill.
+ * @param filename The file, relative to the docroot, as a client would ask for it.
+ * @return 0 if the file is now cached, -1 if it could not be read or is too big.
+ */
+int preload_file(Cache* cache, const char* filename);
+
+/**
+ * @brief Send a 503 on a connection whose request hasn't been read.
+ *
+ * Never blocks, so an accepting thread can afford it under load. The
+ * caller closes the connection.
+ */
+void send_unavailable(int connfd);
+
+/**
+ * @brief Send all of buf, retrying short sends.
+ *
+ * @return The number of bytes sent, which is less than len on error.
+ */
+long send_all(int connfd, const char* buf, long len);
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file HttpDate.c
+ * @brief The Date header, formatted at most once per second.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "HttpDate.h"
+
+/* A reader would have to stall this many seconds mid-copy to see a
+ * buffer being rewritten, and then it notices and tries again. */
+#define DATE_SLOTS 8
+
+typedef struct DateSlot {
+	char text[HTTP_DATE_SIZE];
+	int len;
+} DateSlot;
+
+static DateSlot slots[DATE_SLOTS];
+static atomic_long published = -1;   // the second in slots[published % DATE_SLOTS]
+static atomic_long formatting = -1;  // the second someone has claimed to format
+
+int http_date_now(char* out) {
+	// time() is a vDSO call, far cheaper than formatting
+	long now = time(NULL);
+
+	for(;;) {
+		long current = atomic_load_explicit(&published, memory_order_acquire);
+		if(current != now) {
+			// Only one thread formats each second; the rest carry on
+			// with the previous second's date until it is published.
+			long claimed = atomic_load_explicit(&formatting, memory_order_relaxed);
+			if(claimed < now && atomic_compare_exchange_strong(&formatting, &claimed, now)) {
+				DateSlot* slot = &slots[now % DATE_SLOTS];
+				slot->len = format_http_date(slot->text, sizeof(slot->text), now);
+				atomic_store_explicit(&published, now, memory_order_release);
+				current = now;
+			} else if(current < 0) {
+				// nothing published yet, so format our own
+				return format_http_date(out, HTTP_DATE_SIZE, now);
+			}
+		}
+
+		DateSlot* slot = &slots[current % DATE_SLOTS];
+		int len = slot->len;
+		memcpy(out, slot->text, HTTP_DATE_SIZE);
+
+		// If the ring came all the way around while we copied, our
+		// slot may have been half rewritten.
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&published, memory_order_relaxed) - current < DATE_SLOTS - 1) {
+			return len;
+		}
+		now = time(NULL);
+	}
+}
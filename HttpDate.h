@@ -0,0 +1,27 @@
+/**
+ * @file HttpDate.h
+ * @brief The Date header, formatted at most once per second.
+ *
+ * Every response needs the current time as an IMF-fixdate. Rather than
+ * have each one call gmtime() and strftime(), the first request in a
+ * new second formats it into one of a ring of buffers and publishes
+ * it; everyone else copies the published string without locking.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef HTTP_DATE_H
+#define HTTP_DATE_H
+
+#include "Conditional.h"
+
+/**
+ * @brief Copy the current date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ * @param out Room for HTTP_DATE_SIZE bytes.
+ * @return The length of the date.
+ */
+int http_date_now(char* out);
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file HttpResponse.c
+ * @brief Helpers for cached HTTP responses.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "HttpResponse.h"
+#include "Slab.h"
+#include "Numa.h"
+
+unsigned long http_response_hash(const char* filename) {
+	unsigned long h = 14695981039346656037UL;
+	while(*filename) {
+		h ^= (unsigned char)*filename++;
+		h *= 1099511628211UL;
+	}
+	return h;
+}
+
+HttpResponse* create_http_response(const char* filename, ContentEncoding encoding,
+                                   const char* content_type, const struct stat* file_stats,
+                                   const char* headers, unsigned int header_len,
+                                   unsigned long filesize) {
+	size_t key_len = strlen(filename);
+	HttpResponse* resp = slab_alloc(sizeof(HttpResponse) + key_len + 1 + header_len + filesize);
+	if(resp == NULL) {
+		return NULL;
+	}
+	resp->prev = NULL;
+	resp->next = NULL;
+	resp->hash = http_response_hash(filename);
+	resp->filesize = filesize;
+	atomic_init(&resp->reference_count, 1);
+	atomic_init(&resp->remote_hits, 0);
+	resp->node = numa_node();
+	resp->key_len = key_len;
+	resp->header_len = header_len;
+	resp->encoding = encoding;
+	resp->content_type = content_type;
+	resp->ino = file_stats->st_ino;
+	resp->mtime = file_stats->st_mtime;
+	// setting access time
+	clock_gettime(CLOCK_REALTIME, &(resp->access_time));
+
+	memcpy(resp->data, filename, key_len + 1);
+	memcpy(resp->data + key_len + 1, headers, header_len);
+	return resp;
+}
+
+HttpResponse* copy_http_response(const HttpResponse* resp) {
+	size_t size = sizeof(HttpResponse) + resp->key_len + 1 + resp->header_len + resp->filesize;
+	HttpResponse* copy = slab_alloc(size);
+	if(copy == NULL) {
+		return NULL;
+	}
+	//Written by this thread, so the pages are faulted in on its node
+	memcpy(copy, resp, size);
+	copy->prev = NULL;
+	copy->next = NULL;
+	atomic_init(&copy->reference_count, 1);
+	atomic_init(&copy->remote_hits, 0);
+	copy->node = numa_node();
+	return copy;
+}
+
+void pick_up(HttpResponse* resp) {
+	atomic_fetch_add_explicit(&resp->reference_count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Drop a reference to an HttpResponse.
+ *
+ * Whoever drops the last reference, be it the cache evicting it or
+ * the last thread sending it, frees it.
+ *
+ * @param resp The response. May be NULL.
+ */
+void put_down(HttpResponse* resp) {
+	if(resp == NULL) {
+		return;
+	}
+	if(atomic_fetch_sub_explicit(&resp->reference_count, 1, memory_order_acq_rel) == 1) {
+		slab_free(resp);
+	}
+}
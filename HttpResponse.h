@@ -1,6 +1,20 @@
 /**
  * @file HttpResponse.h
  * @brief Struct for maintaining a cached HTTP response.
+ *
+ * A cached response is a single allocation: this fixed-size header,
+ * followed by the filename (the cache key), the pre-rendered header
+ * block and the body, back to back. A lookup compares the hash and the
+ * inline key, and a send writes the header block and body as one
+ * contiguous region, so neither chases pointers to other allocations.
+ *
+ *   +----------------+----------+--------------+------------+
+ *   | HttpResponse   | key \0   | header block | body       |
+ *   +----------------+----------+--------------+------------+
+ *
+ * The header block holds every header except the status line and the
+ * Date, which change per request, and ends with the blank line.
+ *
  * @author Josh Hellauer
  * @date 2024-11-04
  */
@@ -8,15 +22,102 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
-#define MAX 5
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "Encoding.h"
 
 typedef struct HttpResponse {
-    char* filename;
-    char* response; // file contents only 
-    unsigned long filesize;
+    // links for the cache holding this response; unused by the PQ
+    struct HttpResponse* prev;
+    struct HttpResponse* next;
+
+    unsigned long hash;          // http_response_hash() of the key
+    unsigned long filesize;      // length of the body
+    atomic_int reference_count;  // one for the cache, one for each sender
+    atomic_int remote_hits;      // from other NUMA nodes, see Cache.c
+    int node;                    // the NUMA node it was allocated on
+    unsigned int key_len;        // without the terminator
+    unsigned int header_len;
+    ContentEncoding encoding;    // part of the key: variants of a file share its name
+    const char* content_type;    // from mime_type(), so hits don't look it up again
+    unsigned long ino;           // of the file the body was read from,
+    time_t mtime;                // both used for its ETag
     struct timespec access_time;
+
+    char data[];                 // key, header block, body
 } HttpResponse;
 
-void free_http_response(HttpResponse* resp);
+/**
+ * @brief Allocate a response with room for its key, headers and body.
+ *
+ * The reference count starts at 1, owned by the caller. The body is
+ * left for the caller to fill in.
+ *
+ * @param filename The cache key.
+ * @param encoding How the body is encoded, the rest of the key.
+ * @param content_type The MIME type; must outlive the response.
+ * @param file_stats The file the body is read from.
+ * @param headers The pre-rendered header block.
+ * @param header_len Its length.
+ * @param filesize The length of the body.
+ * @return The new response, or NULL.
+ */
+HttpResponse* create_http_response(const char* filename, ContentEncoding encoding,
+                                   const char* content_type, const struct stat* file_stats,
+                                   const char* headers, unsigned int header_len,
+                                   unsigned long filesize);
+
+/**
+ * @brief Copy a response onto the calling thread's NUMA node.
+ *
+ * The copy is not in any cache and has a reference count of 1.
+ *
+ * @return The copy, or NULL.
+ */
+HttpResponse* copy_http_response(const HttpResponse* resp);
+
+/**
+ * @brief Take another reference to a response.
+ */
+void pick_up(HttpResponse* resp);
+
+/**
+ * @brief Drop a reference, freeing the response with the last one.
+ */
+void put_down(HttpResponse* resp);
+
+/**
+ * @brief FNV-1a hash of a filename.
+ *
+ * The encoding is left out, so every variant of a file lands in the
+ * same shard.
+ */
+unsigned long http_response_hash(const char* filename);
+
+static inline const char* http_response_key(const HttpResponse* resp) {
+    return resp->data;
+}
+
+static inline const char* http_response_headers(const HttpResponse* resp) {
+    return resp->data + resp->key_len + 1;
+}
+
+static inline const char* http_response_body(const HttpResponse* resp) {
+    return http_response_headers(resp) + resp->header_len;
+}
+
+static inline char* http_response_writable_body(HttpResponse* resp) {
+    return resp->data + resp->key_len + 1 + resp->header_len;
+}
+
+/**
+ * @brief Does this response have the given key?
+ */
+static inline int http_response_matches(const HttpResponse* resp, const char* filename,
+                                        unsigned long hash, ContentEncoding encoding) {
+    return resp->hash == hash && resp->encoding == encoding && strcmp(resp->data, filename) == 0;
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,174 @@
+/**
+ * @file Mime.c
+ * @brief Content-Type lookup by file extension.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "Mime.h"
+#include "MimeTable.h"
+
+/**
+ * @struct MimeOverride
+ * @brief One slot of the table loaded by mime_load().
+ */
+typedef struct MimeOverride {
+	char* ext;   // NULL for an empty slot
+	char* type;
+} MimeOverride;
+
+/* Open addressing with linear probing, at most half full. */
+static MimeOverride* overrides;
+static unsigned long override_size;
+
+static MimeOverride* find_override(const char* ext, size_t len) {
+	unsigned long slot = mime_hash(0, ext, len) & (override_size - 1);
+	while(overrides[slot].ext != NULL
+	      && (strlen(overrides[slot].ext) != len || memcmp(overrides[slot].ext, ext, len) != 0)) {
+		slot = (slot + 1) & (override_size - 1);
+	}
+	return &overrides[slot];
+}
+
+/**
+ * @brief Add an extension, replacing an earlier one from the same file.
+ */
+static int add_override(const char* ext, const char* type) {
+	size_t len = strlen(ext);
+	MimeOverride* slot = find_override(ext, len);
+	char* copy = strdup(type);
+	if(copy == NULL) {
+		return -1;
+	}
+	if(slot->ext == NULL) {
+		slot->ext = strdup(ext);
+		if(slot->ext == NULL) {
+			free(copy);
+			return -1;
+		}
+	} else {
+		free(slot->type);
+	}
+	slot->type = copy;
+	return 0;
+}
+
+int mime_load(const char* path) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	// Count the extensions first, so the table never has to grow.
+	char line[1024];
+	unsigned long count = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		char* hash = strchr(line, '#');
+		if(hash != NULL) {
+			*hash = '\0';
+		}
+		if(strtok(line, " \t\r\n") != NULL) {
+			while(strtok(NULL, " \t\r\n") != NULL) {
+				count++;
+			}
+		}
+	}
+
+	override_size = 1;
+	while(override_size < count * 2 + 1) {
+		override_size *= 2;
+	}
+	overrides = calloc(override_size, sizeof(MimeOverride));
+	if(overrides == NULL) {
+		perror("could not allocate MIME types");
+		fclose(f);
+		return -1;
+	}
+
+	rewind(f);
+	int lineno = 0;
+	int ret = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		char* hash = strchr(line, '#');
+		if(hash != NULL) {
+			*hash = '\0';
+		}
+		char* type = strtok(line, " \t\r\n");
+		if(type == NULL) {
+			continue;
+		}
+		char* ext;
+		while((ext = strtok(NULL, " \t\r\n")) != NULL) {
+			if(strlen(ext) >= MIME_EXT_MAX) {
+				fprintf(stderr, "%s:%d: extension '%s' too long\n", path, lineno, ext);
+				ret = -1;
+				continue;
+			}
+			for(char* c = ext; *c; c++) {
+				*c = tolower((unsigned char)*c);
+			}
+			if(add_override(ext, type) < 0) {
+				perror("could not allocate MIME types");
+				ret = -1;
+			}
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+const char* mime_type(const char* filename) {
+	const char* dot = strrchr(filename, '.');
+	if(dot == NULL || strchr(dot, '/') != NULL) {
+		return MIME_DEFAULT_TYPE;
+	}
+
+	char ext[MIME_EXT_MAX];
+	size_t len = 0;
+	for(const char* c = dot + 1; *c; c++) {
+		if(len == MIME_EXT_MAX - 1) {
+			return MIME_DEFAULT_TYPE;
+		}
+		ext[len++] = tolower((unsigned char)*c);
+	}
+	ext[len] = '\0';
+
+	if(overrides != NULL) {
+		MimeOverride* slot = find_override(ext, len);
+		if(slot->ext != NULL) {
+			return slot->type;
+		}
+	}
+
+	// A perfect hash: the only extension that can be here is this one
+	unsigned long slot = mime_hash(MIME_TABLE_SEED, ext, len) & (MIME_TABLE_SIZE - 1);
+	if(mime_table[slot].ext != NULL && strcmp(mime_table[slot].ext, ext) == 0) {
+		return mime_table[slot].type;
+	}
+	return MIME_DEFAULT_TYPE;
+}
+
+int mime_compressible(const char* type) {
+	static const char* text_types[] = {
+		"application/json", "application/manifest+json", "application/ld+json",
+		"application/xhtml+xml", "application/rss+xml", "application/atom+xml",
+		"application/wasm", "application/dash+xml", "application/vnd.apple.mpegurl",
+		"image/svg+xml", "image/x-icon", "image/bmp",
+	};
+	if(strncmp(type, "text/", 5) == 0) {
+		return 1;
+	}
+	for(size_t i = 0; i < sizeof(text_types) / sizeof(text_types[0]); i++) {
+		if(strcmp(type, text_types[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file Mime.h
+ * @brief Content-Type lookup by file extension.
+ *
+ * The built-in types come from mime.types, which tools/mkmime turns
+ * into a perfect hash table (MimeTable.h) at build time: every known
+ * extension has its own slot, so a lookup is one hash and one compare,
+ * with no allocation. Types loaded with --mime-types are checked first.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef MIME_H
+#define MIME_H
+
+#include <stddef.h>
+
+/**
+ * @brief Longer extensions than this are never looked up.
+ */
+#define MIME_EXT_MAX 16
+
+/**
+ * @brief The type of files with an unknown or no extension.
+ */
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+/**
+ * @brief The hash used by both tables. Extensions are already lowercase.
+ *
+ * Shared with tools/mkmime, which picks the seed.
+ */
+static inline unsigned long mime_hash(unsigned long seed, const char* ext, size_t len) {
+	unsigned long h = 14695981039346656037UL ^ seed;
+	for(size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)ext[i];
+		h *= 1099511628211UL;
+	}
+	return h ^ (h >> 29);
+}
+
+/**
+ * @brief Load extra types from a file in mime.types format.
+ *
+ * These take precedence over the built-in ones. Call once, before the
+ * server starts handling requests.
+ *
+ * @return 0 on success, -1 on error (already reported on stderr).
+ */
+int mime_load(const char* path);
+
+/**
+ * @brief The Content-Type of a file, by its extension.
+ *
+ * @return The type, which lives for the rest of the program. Never NULL.
+ */
+const char* mime_type(const char* filename);
+
+/**
+ * @brief Is a type worth compressing, i.e. is it text?
+ */
+int mime_compressible(const char* type);
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file NegativeCache.c
+ * @brief Remembers paths that don't exist, so repeat 404s skip the disk.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "NegativeCache.h"
+#include "HttpResponse.h"
+
+/* Each set holds this many paths; the oldest (soonest to expire) goes. */
+#define WAYS 4
+
+/**
+ * @struct Missing
+ * @brief A remembered missing path.
+ */
+typedef struct Missing {
+	unsigned long hash;
+	char* filename;                // NULL for an empty way
+	time_t expires;                // CLOCK_MONOTONIC seconds
+	int parent_exists;
+	struct timespec parent_mtime;  // when parent_exists
+} Missing;
+
+typedef struct MissingSet {
+	pthread_mutex_t mutex;
+	Missing ways[WAYS];
+} MissingSet;
+
+static MissingSet* sets;
+static unsigned long set_count;
+static int ttl_seconds;
+static int check_parent_mtime;
+
+static time_t now_seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return now.tv_sec;
+}
+
+/**
+ * @brief stat() the directory a path is in.
+ */
+static void stat_parent(const char* filename, Missing* m) {
+	const char* slash = strrchr(filename, '/');
+	char parent[4096];
+	if(slash == NULL) {
+		strcpy(parent, ".");
+	} else if((size_t)(slash - filename) < sizeof(parent)) {
+		memcpy(parent, filename, slash - filename);
+		parent[slash - filename] = '\0';
+	} else {
+		m->parent_exists = 0;
+		return;
+	}
+	struct stat st;
+	m->parent_exists = stat(parent, &st) == 0;
+	if(m->parent_exists) {
+		m->parent_mtime = st.st_mtim;
+	}
+}
+
+static void clear_way(Missing* m) {
+	free(m->filename);
+	m->filename = NULL;
+}
+
+int negative_cache_init(int entries, int ttl, int check_parent) {
+	if(entries <= 0) {
+		return 0;
+	}
+	set_count = (entries + WAYS - 1) / WAYS;
+	sets = calloc(set_count, sizeof(MissingSet));
+	if(sets == NULL) {
+		return -1;
+	}
+	for(unsigned long i = 0; i < set_count; i++) {
+		pthread_mutex_init(&sets[i].mutex, NULL);
+	}
+	ttl_seconds = ttl;
+	check_parent_mtime = check_parent;
+	return 0;
+}
+
+/**
+ * @brief Find filename in its set. Called with the set locked.
+ */
+static Missing* find(MissingSet* set, const char* filename, unsigned long hash) {
+	for(int i = 0; i < WAYS; i++) {
+		Missing* m = &set->ways[i];
+		if(m->filename != NULL && m->hash == hash && strcmp(m->filename, filename) == 0) {
+			return m;
+		}
+	}
+	return NULL;
+}
+
+int negative_cache_lookup(const char* filename) {
+	if(sets == NULL) {
+		return 0;
+	}
+	unsigned long hash = http_response_hash(filename);
+	MissingSet* set = &sets[hash % set_count];
+
+	pthread_mutex_lock(&set->mutex);
+	Missing* m = find(set, filename, hash);
+	int found = m != NULL && m->expires > now_seconds();
+	Missing parent = { 0 };
+	if(found) {
+		parent = *m;
+	}
+	pthread_mutex_unlock(&set->mutex);
+
+	// Without a watcher, a file appearing in the directory shows up
+	// as a new mtime. One stat() of the parent is still far cheaper
+	// than failing to open the file and its siblings.
+	if(found && check_parent_mtime) {
+		Missing current;
+		stat_parent(filename, &current);
+		if(current.parent_exists != parent.parent_exists
+		   || (current.parent_exists
+		       && (current.parent_mtime.tv_sec != parent.parent_mtime.tv_sec
+		           || current.parent_mtime.tv_nsec != parent.parent_mtime.tv_nsec))) {
+			negative_cache_invalidate(filename);
+			found = 0;
+		}
+	}
+	return found;
+}
+
+void negative_cache_insert(const char* filename) {
+	if(sets == NULL) {
+		return;
+	}
+	unsigned long hash = http_response_hash(filename);
+	MissingSet* set = &sets[hash % set_count];
+
+	Missing fresh = { 0 };
+	if(check_parent_mtime) {
+		stat_parent(filename, &fresh);
+	}
+	char* copy = strdup(filename);
+	if(copy == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&set->mutex);
+	Missing* m = find(set, filename, hash);
+	if(m == NULL) {
+		// An empty way, or else the one closest to expiring
+		m = &set->ways[0];
+		for(int i = 0; i < WAYS && m->filename != NULL; i++) {
+			if(set->ways[i].filename == NULL || set->ways[i].expires < m->expires) {
+				m = &set->ways[i];
+			}
+		}
+	}
+	clear_way(m);
+	*m = fresh;
+	m->hash = hash;
+	m->filename = copy;
+	m->expires = now_seconds() + ttl_seconds;
+	pthread_mutex_unlock(&set->mutex);
+}
+
+void negative_cache_invalidate(const char* filename) {
+	if(sets == NULL) {
+		return;
+	}
+	unsigned long hash = http_response_hash(filename);
+	MissingSet* set = &sets[hash % set_count];
+
+	pthread_mutex_lock(&set->mutex);
+	Missing* m = find(set, filename, hash);
+	if(m != NULL) {
+		clear_way(m);
+	}
+	pthread_mutex_unlock(&set->mutex);
+}
+
+void negative_cache_clear(void) {
+	for(unsigned long i = 0; sets != NULL && i < set_count; i++) {
+		pthread_mutex_lock(&sets[i].mutex);
+		for(int j = 0; j < WAYS; j++) {
+			clear_way(&sets[i].ways[j]);
+		}
+		pthread_mutex_unlock(&sets[i].mutex);
+	}
+}
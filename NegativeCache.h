@@ -0,0 +1,52 @@
+/**
+ * @file NegativeCache.h
+ * @brief Remembers paths that don't exist, so repeat 404s skip the disk.
+ *
+ * A scanner asking for thousands of missing paths would otherwise cost
+ * a failed open() (and, for text types, one per compressed sibling)
+ * every time. Misses are remembered in a bounded, set-associative
+ * table for --neg-cache-ttl seconds. An entry also goes as soon as the
+ * watcher sees the path created, or, without a watcher, as soon as the
+ * parent directory's mtime changes.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef NEGATIVE_CACHE_H
+#define NEGATIVE_CACHE_H
+
+/**
+ * @brief Set up the table.
+ *
+ * Until this is called (or if entries is 0) nothing is remembered.
+ *
+ * @param entries The most paths remembered at once.
+ * @param ttl How many seconds a path is remembered for.
+ * @param check_parent 1 to check the parent directory's mtime on every
+ *                     hit, for when there is no watcher.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int negative_cache_init(int entries, int ttl, int check_parent);
+
+/**
+ * @brief Is filename known not to exist?
+ */
+int negative_cache_lookup(const char* filename);
+
+/**
+ * @brief Remember that filename doesn't exist.
+ */
+void negative_cache_insert(const char* filename);
+
+/**
+ * @brief Forget filename, which has just been created.
+ */
+void negative_cache_invalidate(const char* filename);
+
+/**
+ * @brief Forget everything, e.g. when a whole directory appears.
+ */
+void negative_cache_clear(void);
+
+#endif
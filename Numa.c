@@ -0,0 +1,147 @@
+/**
+ * @file Numa.c
+ * @brief NUMA topology, worker placement and node-local memory.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "Numa.h"
+
+/* From <numaif.h>, which comes with libnuma rather than the kernel headers. */
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+
+static int node_count = 1;
+static int node_ids[NUMA_MAX_NODES];          // the kernel's number for each of ours
+static cpu_set_t node_cpus[NUMA_MAX_NODES];
+static unsigned char cpu_node[CPU_SETSIZE];   // ours, by CPU
+
+static __thread int pinned_node = -1;
+
+/**
+ * @brief Parse a sysfs list such as "0-11,24-35", calling fn on each number.
+ *
+ * @return 0 on success, -1 if the file can't be read.
+ */
+static int read_list(const char* path, void (*fn)(int n, void* arg), void* arg) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) {
+		return -1;
+	}
+	char line[4096];
+	if(fgets(line, sizeof(line), f) == NULL) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	char* s = line;
+	while(*s != '\0' && *s != '\n') {
+		char* end;
+		long lo = strtol(s, &end, 10);
+		long hi = lo;
+		if(end == s) {
+			break;
+		}
+		if(*end == '-') {
+			s = end + 1;
+			hi = strtol(s, &end, 10);
+		}
+		for(long n = lo; n <= hi; n++) {
+			fn((int)n, arg);
+		}
+		s = *end == ',' ? end + 1 : end;
+	}
+	return 0;
+}
+
+static void add_node(int id, void* arg) {
+	int* count = arg;
+	if(*count < NUMA_MAX_NODES) {
+		node_ids[(*count)++] = id;
+	}
+}
+
+static void add_cpu(int cpu, void* arg) {
+	int node = (int)(intptr_t)arg;
+	if(cpu >= 0 && cpu < CPU_SETSIZE) {
+		CPU_SET(cpu, &node_cpus[node]);
+		cpu_node[cpu] = node;
+	}
+}
+
+int numa_init(void) {
+	int count = 0;
+	if(read_list("/sys/devices/system/node/online", add_node, &count) < 0 || count < 2) {
+		return node_count;
+	}
+	for(int i = 0; i < count; i++) {
+		char path[64];
+		CPU_ZERO(&node_cpus[i]);
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_ids[i]);
+		read_list(path, add_cpu, (void*)(intptr_t)i);
+	}
+	//Memory-only nodes have no CPUs to pin to; leave them to numa_bind()
+	node_count = count;
+	return node_count;
+}
+
+int numa_nodes(void) {
+	return node_count;
+}
+
+void numa_pin_worker(int index) {
+	if(node_count < 2) {
+		return;
+	}
+	int node = index % node_count;
+	if(CPU_COUNT(&node_cpus[node]) == 0) {
+		return;
+	}
+	if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &node_cpus[node]) == 0) {
+		pinned_node = node;
+	}
+}
+
+int numa_node(void) {
+	if(node_count < 2) {
+		return 0;
+	}
+	if(pinned_node >= 0) {
+		return pinned_node;
+	}
+	//Unpinned threads may have moved since, but only to be wrong once
+	int cpu = sched_getcpu();
+	return cpu >= 0 && cpu < CPU_SETSIZE ? cpu_node[cpu] : 0;
+}
+
+void numa_bind(void* p, size_t len, int node) {
+	if(node_count < 2) {
+		return;
+	}
+	long page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1);
+	uintptr_t end = ((uintptr_t)p + len) & ~(uintptr_t)(page - 1);
+	if(end <= start) {
+		return;
+	}
+	unsigned long mask[(NUMA_MAX_NODES + 63) / 64] = { 0 };
+	int id = node_ids[node];
+	if(id >= NUMA_MAX_NODES) {
+		return;
+	}
+	mask[id / 64] |= 1UL << (id % 64);
+	//Only a preference: when the node is full, anywhere beats failing
+	syscall(SYS_mbind, (void*)start, end - start, NUMA_MPOL_PREFERRED, mask,
+	        (unsigned long)NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE);
+}
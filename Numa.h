@@ -0,0 +1,59 @@
+/**
+ * @file Numa.h
+ * @brief NUMA topology, worker placement and node-local memory.
+ *
+ * The topology is read from /sys/devices/system/node, so no libnuma is
+ * needed. Workers are spread round-robin over the nodes and pinned to
+ * their node's CPUs (not to one CPU, so the scheduler can still
+ * balance within a node); memory the Slab hands out then comes from
+ * the node of the thread asking for it, see Slab.h.
+ *
+ * On a machine with a single node, or before numa_init(), everything
+ * here is a no-op and every thread is on node 0.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+/* Nodes beyond this are folded onto the first ones. */
+#define NUMA_MAX_NODES 64
+
+/**
+ * @brief Read the topology.
+ *
+ * @return The number of nodes, 1 if it can't be read.
+ */
+int numa_init(void);
+
+/**
+ * @return The number of nodes, 1 before numa_init().
+ */
+int numa_nodes(void);
+
+/**
+ * @brief Pin the calling thread to a node's CPUs.
+ *
+ * @param index Which worker this is; workers go round-robin over the nodes.
+ */
+void numa_pin_worker(int index);
+
+/**
+ * @return The node the calling thread runs on, from 0 to numa_nodes() - 1.
+ */
+int numa_node(void);
+
+/**
+ * @brief Ask for the whole pages within [p, p + len) to live on a node.
+ *
+ * Pages already touched are moved there too. Does nothing with one node.
+ * Only for memory the caller mapped itself: heap pages are shared with
+ * unrelated allocations, which would be moved along with it.
+ */
+void numa_bind(void* p, size_t len, int node);
+
+#endif
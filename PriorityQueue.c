@@ -27,12 +27,15 @@
 /**
  * @brief Simple swap function
  *
- * @param a The first HttpResponse
- * @param b The second HttpResponse
+ * Swaps the slots, not the HttpResponses themselves, so a pointer
+ * returned by search() keeps pointing at the same response.
+ *
+ * @param a The first HttpResponse slot
+ * @param b The second HttpResponse slot
  */
-void swap(HttpResponse* a, HttpResponse* b)
+void swap(HttpResponse** a, HttpResponse** b)
 {
-    HttpResponse temp = *a;
+    HttpResponse* temp = *a;
     *a = *b;
     *b = temp;
 }
@@ -61,22 +64,54 @@ int compare_timespec(struct timespec *time1, struct timespec *time2) {
     }
 }
 
+/**
+ * @brief Allocate an empty PriorityQueue.
+ *
+ * @param capacity The maximum number of entries.
+ * @param max_bytes The maximum total size of cached bodies, or 0 for no limit.
+ * @param refresh_on_hit 1 to evict the least recently used entry,
+ *                       0 to evict the oldest insertion.
+ * @return The new PriorityQueue, or NULL.
+ */
+PriorityQueue* create_priority_queue(int capacity, long max_bytes, int refresh_on_hit)
+{
+    PriorityQueue* pq = malloc(sizeof(PriorityQueue));
+    if (pq == NULL) {
+        return NULL;
+    }
+    pq->items = malloc(capacity * sizeof(HttpResponse*));
+    if (pq->items == NULL) {
+        free(pq);
+        return NULL;
+    }
+    pq->size = 0;
+    pq->capacity = capacity;
+    pq->bytes = 0;
+    pq->max_bytes = max_bytes;
+    pq->refresh_on_hit = refresh_on_hit;
+    return pq;
+}
+
 /**
  * @brief Search a PriorityQueue.
  *
  * @param pq The Priority Queue to search.
  * @param target The filename to match.
+ * @param hash http_response_hash() of target.
+ * @param encoding Which variant of target.
  * @return An HttpResponse with filename target, or NULL.
  */
-HttpResponse* search(PriorityQueue* pq, char* target) 
+HttpResponse* search(PriorityQueue* pq, const char* target, unsigned long hash, ContentEncoding encoding) 
 {
     HttpResponse* ret = NULL;
 
     for(int i = 0; i < pq->size; i++) {
-        if(strcmp(pq->items[i]->filename, target) == 0) {
+        if(http_response_matches(pq->items[i], target, hash, encoding)) {
             ret = pq->items[i];
-            clock_gettime(CLOCK_REALTIME, &(pq->items[i]->access_time));
-            heapifyUp(pq, i);
+            if (pq->refresh_on_hit) {
+                clock_gettime(CLOCK_REALTIME, &(pq->items[i]->access_time));
+                heapifyUp(pq, i);
+            }
             break;
         }
     }
@@ -98,45 +133,159 @@ void heapifyUp(PriorityQueue* pq, int index)
 {
     if (index
         && compare_timespec(&(pq->items[(index - 1) / 2]->access_time), &(pq->items[index]->access_time)) == -1) {
-        swap(pq->items[(index - 1) / 2],
-             pq->items[index]);
+        swap(&pq->items[(index - 1) / 2],
+             &pq->items[index]);
         heapifyUp(pq, (index - 1) / 2);
     }
 }
 
+/**
+ * @brief Heapify down.
+ *
+ * Keep pushing PQ[index] down further until the heap
+ * property is restored.
+ *
+ * @param pq The Priority Queue.
+ * @param index The target index being operated on.
+ */
+void heapifyDown(PriorityQueue* pq, int index)
+{
+    int largest = index;
+    int left = 2 * index + 1;
+    int right = 2 * index + 2;
+
+    if (left < pq->size
+        && compare_timespec(&(pq->items[left]->access_time), &(pq->items[largest]->access_time)) == 1) {
+        largest = left;
+    }
+    if (right < pq->size
+        && compare_timespec(&(pq->items[right]->access_time), &(pq->items[largest]->access_time)) == 1) {
+        largest = right;
+    }
+    if (largest != index) {
+        swap(&pq->items[index], &pq->items[largest]);
+        heapifyDown(pq, largest);
+    }
+}
+
+/**
+ * @brief Remove the entry in a slot and drop the PQ's reference.
+ *
+ * The last entry takes its place and is moved whichever way restores
+ * the heap property.
+ *
+ * @param pq The Priority Queue.
+ * @param index The slot to empty.
+ */
+static void remove_at(PriorityQueue* pq, int index)
+{
+    HttpResponse* old = pq->items[index];
+    pq->bytes -= old->filesize;
+    pq->items[index] = pq->items[--pq->size];
+    if (index < pq->size) {
+        heapifyUp(pq, index);
+        heapifyDown(pq, index);
+    }
+    put_down(old);
+}
+
+/**
+ * @brief Remove every encoding of a file from the PQ.
+ *
+ * @param pq The Priority Queue.
+ * @param target The filename to remove.
+ * @param hash http_response_hash() of target.
+ * @return The number of entries removed.
+ */
+int remove_file(PriorityQueue* pq, const char* target, unsigned long hash)
+{
+    int removed = 0;
+    int i = 0;
+    while (i < pq->size) {
+        HttpResponse* item = pq->items[i];
+        if (item->hash == hash && strcmp(http_response_key(item), target) == 0) {
+            remove_at(pq, i);
+            removed++;
+            // whatever moved into slot i still has to be checked,
+            // and it may have come from anywhere, so start over
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+    return removed;
+}
+
+/**
+ * @brief Remove every entry from the PQ.
+ *
+ * @param pq The Priority Queue.
+ */
+void remove_all(PriorityQueue* pq)
+{
+    while (pq->size > 0) {
+        put_down(pq->items[--pq->size]);
+    }
+    pq->bytes = 0;
+}
+
+/**
+ * @brief Remove the entry with the oldest access time.
+ *
+ * The oldest entry of a max-heap is always a leaf, so only the
+ * last size/2 + 1 nodes need to be checked. The last leaf takes its
+ * place, which keeps it a leaf and only ever needs to move up.
+ *
+ * @param pq The Priority Queue to evict from.
+ */
+static void remove_oldest(PriorityQueue* pq)
+{
+    int amt = pq->size / 2 + 1;
+    int min_index = pq->size - 1;
+    struct timespec min;
+    min.tv_sec = LONG_MAX;
+    min.tv_nsec = LONG_MAX;
+    for(int i = 0; i < amt && i < pq->size; i++) {
+        if(compare_timespec(&(pq->items[pq->size - i - 1]->access_time), &min) == -1) {
+            min = pq->items[pq->size - i - 1]->access_time;
+            min_index = pq->size - i - 1;
+        }
+    }
+    HttpResponse* old = pq->items[min_index];
+    printf("Freeing %s\n", http_response_key(old));
+    pq->bytes -= old->filesize;
+    pq->items[min_index] = pq->items[--pq->size];
+    if (min_index < pq->size) {
+        heapifyUp(pq, min_index);
+    }
+    put_down(old);
+}
+
 /**
  * @brief Enqueue a new HttpResponse into the PQ.
  *
- * If the PQ is at max capacity, enqueue() will also remove
- * the entry with the oldest request time. This could have been 
- * better compartmentalized into a dequeue() function.  
+ * If the PQ is at max capacity, or the new entry would push it over its
+ * byte limit, enqueue() will also remove the entries with the oldest
+ * request time until there is room.
+ *
+ * The PQ picks up its own reference to the value.
  *
  * @param pq The Priority Queue which shall be inserted into.
  * @param value The HttpResponse struct to insert into the PQ.
+ * @return 1 if the value was cached, 0 if it is too big to cache.
  */
-void enqueue(PriorityQueue* pq, HttpResponse* value)
+int enqueue(PriorityQueue* pq, HttpResponse* value)
 {
-    if (pq->size == MAX) {
-        // travers the first size/2 nodes and remove the smallest
-        int amt = pq->size / 2 + 1;
-        int min_index = MAX - 1;
-        struct timespec min;
-        min.tv_sec = LONG_MAX;
-        min.tv_nsec = LONG_MAX;
-        for(int i = 0; i < amt; i++) {
-            if(compare_timespec(&(pq->items[pq->size - i - 1]->access_time), &min) == -1) {
-                min = pq->items[pq->size - i - 1]->access_time;
-                min_index = pq->size - i - 1;
-            }
-        }
-        printf("Freeing %s\n", pq->items[min_index]->filename);
-        free(pq->items[min_index]->filename);
-        free(pq->items[min_index]->response);
-        free(pq->items[min_index]);
-        pq->items[min_index] = value;
-        heapifyUp(pq, min_index);
-    } else {
-        pq->items[pq->size++] = value;
-        heapifyUp(pq, pq->size - 1);
+    if (pq->max_bytes > 0 && (long)value->filesize > pq->max_bytes) {
+        return 0;
     }
-}
\ No newline at end of file
+    while (pq->size > 0 && (pq->size == pq->capacity
+           || (pq->max_bytes > 0 && pq->bytes + (long)value->filesize > pq->max_bytes))) {
+        remove_oldest(pq);
+    }
+    pick_up(value);
+    pq->items[pq->size++] = value;
+    pq->bytes += value->filesize;
+    heapifyUp(pq, pq->size - 1);
+    return 1;
+}
@@ -3,30 +3,41 @@
 
 #include "HttpResponse.h"
 
-// Define maximum size of the priority queue
-#define MAX_QUEUE_SIZE 5
-
 // Define PriorityQueue structure
 typedef struct PriorityQueue {
-    HttpResponse* items[MAX];
+    HttpResponse** items;
     int size;
+    int capacity;       // max number of entries
+    long bytes;         // total size of the cached bodies
+    long max_bytes;     // limit on bytes, 0 = unlimited
+    int refresh_on_hit; // 1 = LRU, 0 = FIFO
 } PriorityQueue;
 
-HttpResponse* search(PriorityQueue *pq, char *filename);
+// Define create function to allocate an empty queue
+PriorityQueue* create_priority_queue(int capacity, long max_bytes, int refresh_on_hit);
+
+HttpResponse* search(PriorityQueue *pq, const char *filename, unsigned long hash, ContentEncoding encoding);
 
-// Define swap function to swap two integers
-void swap(HttpResponse* a, HttpResponse* b);
+// Define swap function to swap two heap slots
+void swap(HttpResponse** a, HttpResponse** b);
 
 // Define heapifyUp function to maintain heap property
 // during insertion
 void heapifyUp(PriorityQueue* pq, int index);
 
-// Define enqueue function to add an item to the queue
-void enqueue(PriorityQueue* pq, HttpResponse* value);
+// Define enqueue function to add an item to the queue.
+// The queue picks up its own reference. Returns 0 if it was too big to cache.
+int enqueue(PriorityQueue* pq, HttpResponse* value);
 
 // Define heapifyDown function to maintain heap property
 // during deletion
-int heapifyDown(PriorityQueue* pq, int index);
+void heapifyDown(PriorityQueue* pq, int index);
+
+// Remove every encoding of a file. Returns how many entries went.
+int remove_file(PriorityQueue* pq, const char* target, unsigned long hash);
+
+// Empty the queue.
+void remove_all(PriorityQueue* pq);
 
 // Define dequeue function to remove an item from the queue
 HttpResponse* dequeue(PriorityQueue* pq);
@@ -0,0 +1,134 @@
+/**
+ * @file Range.c
+ * @brief Range requests (RFC 7233).
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include "Range.h"
+#include "Request.h"
+#include "Conditional.h"
+
+/**
+ * @brief Parse a run of digits.
+ *
+ * @return The number of digits read, 0 if there were none or it overflowed.
+ */
+static int parse_position(const char* p, const char* end, long* value) {
+	const char* start = p;
+	long v = 0;
+	while(p < end && *p >= '0' && *p <= '9') {
+		if(v > (LONG_MAX - 9) / 10) {
+			return 0;
+		}
+		v = v * 10 + (*p - '0');
+		p++;
+	}
+	*value = v;
+	return p - start;
+}
+
+/**
+ * @brief Does If-Range (if any) still describe the file?
+ *
+ * An entity tag has to match strongly; a date has to be exactly the
+ * file's Last-Modified.
+ */
+static int if_range_matches(const char* request, const char* etag, time_t mtime) {
+	size_t len;
+	const char* value = request_header(request, "If-Range", &len);
+	if(value == NULL) {
+		return 1;
+	}
+	if(len > 0 && (value[0] == '"' || value[0] == 'W')) {
+		return len == strlen(etag) && memcmp(value, etag, len) == 0;
+	}
+	time_t date;
+	return parse_http_date(value, len, &date) == 0 && date == mtime;
+}
+
+int request_ranges(const char* request, const char* etag, time_t mtime,
+                   long filesize, ByteRange* ranges) {
+	size_t len;
+	const char* value = request_header(request, "Range", &len);
+	if(value == NULL || len < 6 || strncasecmp(value, "bytes=", 6) != 0) {
+		return 0;
+	}
+	if(!if_range_matches(request, etag, mtime)) {
+		return 0;
+	}
+
+	const char* p = value + 6;
+	const char* end = value + len;
+	int count = 0;
+	int specs = 0;
+	while(p < end) {
+		while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+			p++;
+		}
+		if(p == end) {
+			break;
+		}
+
+		long first, last;
+		int n;
+		if(*p == '-') {
+			//the last N bytes
+			p++;
+			if((n = parse_position(p, end, &last)) == 0) {
+				return 0;
+			}
+			p += n;
+			if(last == 0 || filesize == 0) {
+				first = filesize;
+			} else {
+				first = last >= filesize ? 0 : filesize - last;
+			}
+			last = filesize - 1;
+		} else {
+			if((n = parse_position(p, end, &first)) == 0) {
+				return 0;
+			}
+			p += n;
+			if(p == end || *p != '-') {
+				return 0;
+			}
+			p++;
+			n = parse_position(p, end, &last);
+			p += n;
+			if(n == 0) {
+				last = filesize - 1;
+			} else if(last < first) {
+				return 0;
+			} else if(last >= filesize) {
+				last = filesize - 1;
+			}
+		}
+
+		while(p < end && (*p == ' ' || *p == '\t')) {
+			p++;
+		}
+		if(p < end && *p != ',') {
+			return 0;
+		}
+
+		if(++specs > MAX_RANGES) {
+			return 0;
+		}
+		//unsatisfiable ranges are simply left out
+		if(first < filesize) {
+			ranges[count].first = first;
+			ranges[count].last = last;
+			count++;
+		}
+	}
+
+	if(specs == 0) {
+		return 0;
+	}
+	return count > 0 ? count : -1;
+}
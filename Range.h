@@ -0,0 +1,52 @@
+/**
+ * @file Range.h
+ * @brief Range requests (RFC 7233).
+ *
+ * Only byte ranges are understood. A Range header that can't be parsed,
+ * asks for too many pieces, or fails its If-Range is ignored, and the
+ * whole file is sent as usual.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <time.h>
+
+/**
+ * @brief The most ranges one request may ask for.
+ *
+ * Anything more is answered with the whole file, so a client can't make
+ * us send thousands of tiny parts.
+ */
+#define MAX_RANGES 16
+
+/**
+ * @struct ByteRange
+ * @brief A satisfiable range, both ends inclusive as in Content-Range.
+ */
+typedef struct ByteRange {
+	long first;
+	long last;
+} ByteRange;
+
+/**
+ * @brief Work out which parts of a file a request wants.
+ *
+ * Ranges that start past the end of the file are dropped, the rest are
+ * clipped to it, in the order the client gave them.
+ *
+ * @param request The NUL-terminated request.
+ * @param etag The current ETag of the file, for If-Range.
+ * @param mtime The current modification time of the file, for If-Range.
+ * @param filesize The size of the file.
+ * @param ranges Filled in with up to MAX_RANGES ranges.
+ * @return The number of ranges, 0 to send the whole file, or -1 if
+ *         none of the ranges can be satisfied (416).
+ */
+int request_ranges(const char* request, const char* etag, time_t mtime,
+                   long filesize, ByteRange* ranges);
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file Request.c
+ * @brief Reading the path and header fields out of a received request.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "Request.h"
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* request_header(const char* request, const char* name, size_t* len) {
+	size_t name_len = strlen(name);
+
+	//skip the request line
+	const char* line = strchr(request, '\n');
+	while(line != NULL) {
+		line++;
+		const char* end = strchr(line, '\n');
+		if(end == NULL) {
+			end = line + strlen(line);
+		}
+		//a blank line ends the headers
+		if(line == end || (*line == '\r' && line + 1 == end)) {
+			return NULL;
+		}
+
+		if((size_t)(end - line) > name_len && line[name_len] == ':'
+		   && strncasecmp(line, name, name_len) == 0) {
+			const char* value = line + name_len + 1;
+			while(value < end && is_space(*value)) {
+				value++;
+			}
+			const char* value_end = end;
+			while(value_end > value && is_space(value_end[-1])) {
+				value_end--;
+			}
+			*len = value_end - value;
+			return value;
+		}
+
+		line = *end == '\0' ? NULL : end;
+	}
+	return NULL;
+}
+
+static int hex_value(char c) {
+	if(c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c |= 0x20;
+	if(c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/**
+ * @brief A segment has just been written ending at out; keep it or not.
+ *
+ * @param path The start of the output.
+ * @param seg Where the segment starts.
+ * @param out Just past its end.
+ * @return Where the next segment starts.
+ */
+static char* end_segment(char* path, char* seg, char* out) {
+	size_t len = out - seg;
+	if(len == 0 || (len == 1 && seg[0] == '.')) {
+		//"//" or "/./"
+		return seg;
+	}
+	if(len == 2 && seg[0] == '.' && seg[1] == '.') {
+		//drop the segment before, but stop at the docroot
+		if(seg == path) {
+			return path;
+		}
+		char* prev = seg - 1;
+		while(prev > path && prev[-1] != '/') {
+			prev--;
+		}
+		return prev;
+	}
+	*out = '/';
+	return out + 1;
+}
+
+int normalize_path(char* path) {
+	char* in = path;
+	char* out = path;
+	char* seg = path;
+	//The output never gets ahead of the input: an escape is three
+	//characters in and one out, and dropped segments only shrink it.
+	while(*in != '\0' && *in != '?' && *in != '#') {
+		char c = *in++;
+		if(c == '%') {
+			int hi = hex_value(in[0]);
+			int lo = hi < 0 ? -1 : hex_value(in[1]);
+			if(lo < 0 || (hi == 0 && lo == 0)) {
+				return -1;
+			}
+			c = (char)(hi << 4 | lo);
+			in += 2;
+		}
+		if(c == '/') {
+			seg = out = end_segment(path, seg, out);
+		} else {
+			*out++ = c;
+		}
+	}
+	out = end_segment(path, seg, out);
+	//no trailing '/'
+	if(out > path && out[-1] == '/') {
+		out--;
+	}
+	*out = '\0';
+	return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file Request.h
+ * @brief Reading the path and header fields out of a received request.
+ *
+ * The request stays in the buffer it was received into; nothing is
+ * copied or allocated, lookups just return a pointer into it, and the
+ * path is normalized where it lies.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include <stddef.h>
+
+/**
+ * @brief Find a header field in a request.
+ *
+ * The name is matched case-insensitively. Only the header section is
+ * searched, i.e. up to the first blank line.
+ *
+ * @param request The NUL-terminated request, starting with the request line.
+ * @param name The field name, without the colon.
+ * @param len Set to the length of the value.
+ * @return The value with surrounding whitespace trimmed (not
+ *         NUL-terminated), or NULL if the field is not present.
+ */
+const char* request_header(const char* request, const char* name, size_t* len);
+
+/**
+ * @brief Turn a request target into the file it names, in place.
+ *
+ * In a single pass: the query and fragment are cut off, %XX escapes
+ * are decoded, empty and "." segments are dropped and ".." removes the
+ * segment before it, never going above the docroot. The result is
+ * relative, e.g. "a//b/./../%63" becomes "a/c", so it is also the
+ * canonical cache key. Since the result is never longer than the
+ * input, nothing is allocated.
+ *
+ * @param path The target, without its leading '/'.
+ * @return 0 on success, -1 for a malformed escape or an encoded NUL.
+ */
+int normalize_path(char* path);
+
+#endif
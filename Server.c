@@ -0,0 +1,648 @@
+/**
+ * @file Server.c
+ * @brief Socket setup and the concurrency models.
+ *
+ *   proc    fork() a child per connection
+ *   thread  create a detached thread per connection
+ *   pool    a fixed set of worker threads pops connections from a
+ *           bounded queue that the main thread accept()s into
+ *   epoll   like pool, but the main thread waits in epoll until a
+ *           connection has sent its request before queueing it, so
+ *           idle clients don't tie up a worker
+ *   steal   like pool, but a large body is sent a slice at a time and
+ *           the rest pushed on the worker's own work-stealing deque,
+ *           where an idle worker can take it over
+ *   coro    each worker thread accepts connections itself and serves
+ *           each on a coroutine, switching whenever one would block
+ *
+ * @author Dr. Jonathan Misurda
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "Server.h"
+#include "Config.h"
+#include "Cache.h"
+#include "ConnQueue.h"
+#include "WorkDeque.h"
+#include "Coro.h"
+#include "Timeout.h"
+#include "Admission.h"
+#include "Numa.h"
+#include "DiskPool.h"
+#include "Http.h"
+#include "Stats.h"
+#include "Mime.h"
+#include "Watcher.h"
+#include "Warmup.h"
+#include "NegativeCache.h"
+#include "FdCache.h"
+
+static Cache* cache;
+
+static atomic_int next_worker;
+
+/**
+ * @brief Pin the calling worker thread to the next NUMA node in turn.
+ */
+static void place_worker(void) {
+	numa_pin_worker(atomic_fetch_add_explicit(&next_worker, 1, memory_order_relaxed));
+}
+
+/**
+ * @brief Create, bind and listen on the server socket.
+ *
+ * @return The listening socket. Exits on failure.
+ */
+static int open_listen_socket(void) {
+	//Sockets represent potential connections
+	//We make an internet socket
+	int sfd = socket(PF_INET, SOCK_STREAM, 0);
+	if(-1 == sfd)
+	{
+		perror("Cannot create socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Avoid "Bind: Address already in use" failures
+	int yes = 1;
+	setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+
+	addr.sin_family = AF_INET;
+	//Web servers always listen on port 80, unless told otherwise
+	addr.sin_port = htons(config.port);
+	inet_pton(AF_INET, config.bind_address, &addr.sin_addr);
+
+	//So we bind our socket to the port
+	if(-1 == bind(sfd, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		perror("Bind failed");
+		exit(EXIT_FAILURE);
+	}
+
+	//And set it up as a listening socket with a backlog of pending connections
+	if(-1 == listen(sfd, config.backlog))
+	{
+		perror("Listen failed");
+		exit(EXIT_FAILURE);
+	}
+
+	//Report the port we actually got, in case it was ephemeral
+	socklen_t addrlen = sizeof(addr);
+	getsockname(sfd, (struct sockaddr *)&addr, &addrlen);
+	printf("Listening on port %d\n", ntohs(addr.sin_port));
+	fflush(stdout);
+	return sfd;
+}
+
+/**
+ * @brief accept() the next client that is let in, see Admission.h.
+ *
+ * @return The client socket. Exits on failure.
+ */
+static int accept_client(int sfd) {
+	//When it returns, we have a client that we can do client stuff with.
+	int connfd = admission_accept(sfd, 0);
+	if(connfd < 0) {
+		perror("Accept failed");
+		exit(EXIT_FAILURE);
+	}
+	return connfd;
+}
+
+/**
+ * @brief A process per connection.
+ */
+static void run_proc(int sfd) {
+	sem_t* worker_slots = NULL;
+
+	// children give their slot back from their own address space,
+	// so this semaphore has to be shared
+	if(config.workers > 0) {
+		worker_slots = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(worker_slots == MAP_FAILED) {
+			perror("could not allocate memory for worker semaphore");
+			exit(EXIT_FAILURE);
+		}
+		sem_init(worker_slots, 1, config.workers);
+	}
+
+	//Children are never waited on, so have the kernel reap them
+	//instead of leaving a zombie behind for every request
+	signal(SIGCHLD, SIG_IGN);
+
+	//A server's gotta serve...
+	for(int served = 0; ; served++)
+	{
+		if(worker_slots != NULL) {
+			sem_wait(worker_slots);
+		}
+		int connfd = accept_client(sfd);
+		pid_t res = fork();
+		if(res == 0) { // child process
+			close(sfd);
+			numa_pin_worker(served);
+			//threads don't survive fork(), so each child ticks its own
+			if(timeouts_start() < 0) {
+				perror("could not start the timeout thread");
+			}
+			handle_client_connection(connfd, NULL);
+			if(worker_slots != NULL) {
+				sem_post(worker_slots);
+			}
+			exit(EXIT_SUCCESS);
+		} else if(res == -1) {
+			//Out of processes for now; the next one may have better luck
+			perror("Fork failed");
+			admission_turn_away(connfd);
+			if(worker_slots != NULL) {
+				sem_post(worker_slots);
+			}
+			continue;
+		}
+		close(connfd); // connfd was handed off to client handler
+	}
+}
+
+static sem_t thread_slots; // limits concurrent threads when --workers is set
+
+/**
+ * @brief Thread entry point for the thread model.
+ *
+ * @param args The client socket descriptor value.
+ */
+static void* connection_thread(void* args) {
+	place_worker();
+	handle_client_connection((int)(intptr_t)args, cache);
+	if(config.workers > 0) {
+		sem_post(&thread_slots);
+	}
+	return NULL;
+}
+
+/**
+ * @brief A thread per connection.
+ */
+static void run_thread(int sfd) {
+	if(config.workers > 0) {
+		sem_init(&thread_slots, 0, config.workers);
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	//Nobody joins the worker, so let its resources go when it exits
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for(;;)
+	{
+		if(config.workers > 0) {
+			sem_wait(&thread_slots);
+		}
+		int connfd = accept_client(sfd);
+		pthread_t tid;
+		// hand off client handling work to new thread
+		if(pthread_create(&tid, &attr, connection_thread, (void *)(intptr_t)connfd) != 0) {
+			perror("pthread_create");
+			admission_turn_away(connfd);
+			if(config.workers > 0) {
+				sem_post(&thread_slots);
+			}
+		}
+	}
+}
+
+static ConnQueue queue;
+
+/**
+ * @brief Queue a connection for the workers, or turn it away if full.
+ *
+ * @return 0 if it was queued.
+ */
+static int queue_connection(int connfd) {
+	if(!config.queue_reject) {
+		conn_queue_push(&queue, connfd);
+		return 0;
+	}
+	if(conn_queue_try_push(&queue, connfd) < 0) {
+		//Drop its deadline while the descriptor is still ours
+		connection_forget(connfd);
+		admission_turn_away(connfd);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Pool worker: serve queued connections forever.
+ */
+static void* pool_worker(void* args) {
+	place_worker();
+	for(;;) {
+		handle_client_connection(conn_queue_pop(&queue), cache);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Start the pool workers.
+ */
+static void start_pool(void) {
+	if(conn_queue_init(&queue, config.queue_slots) < 0) {
+		perror("could not allocate connection queue");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < config.workers; i++) {
+		pthread_t tid;
+		if(pthread_create(&tid, NULL, pool_worker, NULL) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(tid);
+	}
+}
+
+/**
+ * @brief A fixed pool of threads, fed by accept().
+ */
+static void run_pool(int sfd) {
+	start_pool();
+	for(;;) {
+		queue_connection(accept_client(sfd));
+	}
+}
+
+/**
+ * @brief A fixed pool of threads, fed by connections that have data.
+ *
+ * The listening socket is non-blocking and drained on every wakeup.
+ * Clients are registered one-shot, so each one is handed to exactly
+ * one worker, which then owns it until it is closed.
+ */
+static void run_epoll(int sfd) {
+	start_pool();
+
+	int epfd = epoll_create1(0);
+	if(epfd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = sfd;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) < 0) {
+		perror("epoll_ctl");
+		exit(EXIT_FAILURE);
+	}
+
+	struct epoll_event events[64];
+	for(;;) {
+		int n = epoll_wait(epfd, events, 64, -1);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+		for(int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if(fd != sfd) {
+				// the request (or a hangup) is here, let a worker have it
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+				queue_connection(fd);
+				continue;
+			}
+			for(;;) {
+				int connfd = admission_accept(sfd, 0);
+				if(connfd < 0) {
+					if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+					perror("Accept failed");
+					exit(EXIT_FAILURE);
+				}
+				ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+				ev.data.fd = connfd;
+				//A client that never sends is shut down, which wakes
+				//us up for it like a request would
+				connection_expect_request(connfd);
+				if(epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+					perror("epoll_ctl");
+					connection_forget(connfd);
+					admission_turn_away(connfd);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @struct StealWorker
+ * @brief A steal worker and the transfers it has yet to finish.
+ */
+typedef struct StealWorker {
+	WorkDeque deque;
+	unsigned int seed;      // for picking victims
+	int fresh_first;        // take a new connection before our own transfers
+} StealWorker;
+
+static StealWorker* steal_workers;
+
+// Idle workers sleep here until there is a new connection or a transfer
+// to steal.
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int idle_workers;
+
+/**
+ * @brief Wake an idle worker, if any, after making work available.
+ */
+static void wake_idle_worker(void) {
+	//Pairs with the fence in steal_wait(): either it sees our work,
+	//or we see it waiting
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&idle_workers, memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&idle_mutex);
+		pthread_cond_signal(&idle_cond);
+		pthread_mutex_unlock(&idle_mutex);
+	}
+}
+
+/**
+ * @brief Take a transfer from some other worker, starting at a random one.
+ */
+static Transfer* steal_transfer(StealWorker* self) {
+	int start = rand_r(&self->seed) % config.workers;
+	for(int i = 0; i < config.workers; i++) {
+		StealWorker* victim = &steal_workers[(start + i) % config.workers];
+		if(victim == self) {
+			continue;
+		}
+		Transfer* t = work_deque_steal(&victim->deque);
+		if(t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static int any_stealable(void) {
+	for(int i = 0; i < config.workers; i++) {
+		if(!work_deque_empty(&steal_workers[i].deque)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Sleep until there might be something to do.
+ */
+static void steal_wait(void) {
+	pthread_mutex_lock(&idle_mutex);
+	atomic_fetch_add_explicit(&idle_workers, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	if(queue.size == 0 && !any_stealable()) {
+		pthread_cond_wait(&idle_cond, &idle_mutex);
+	}
+	atomic_fetch_sub_explicit(&idle_workers, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&idle_mutex);
+}
+
+/**
+ * @brief Steal worker: new connections, our own transfers, then other workers'.
+ *
+ * New connections and our own transfers take turns, so a stream of
+ * small requests doesn't wait behind a large body, nor the other way
+ * around. Our own deque is popped newest first; thieves take the
+ * oldest, which have waited longest.
+ */
+static void* steal_worker(void* args) {
+	StealWorker* self = args;
+	place_worker();
+	for(;;) {
+		Transfer* t = NULL;
+		int connfd = -1;
+		if(self->fresh_first) {
+			connfd = conn_queue_try_pop(&queue);
+		}
+		if(connfd < 0) {
+			t = work_deque_pop(&self->deque);
+		}
+		if(connfd < 0 && t == NULL && !self->fresh_first) {
+			connfd = conn_queue_try_pop(&queue);
+		}
+		if(connfd < 0 && t == NULL) {
+			t = steal_transfer(self);
+		}
+		if(connfd < 0 && t == NULL) {
+			steal_wait();
+			continue;
+		}
+		self->fresh_first = connfd < 0;
+
+		t = connfd >= 0 ? handle_client_slice(connfd, cache) : transfer_continue(t);
+		if(t != NULL) {
+			if(work_deque_push(&self->deque, t) < 0) {
+				//no room to put it aside, so finish it here
+				while(t != NULL) {
+					t = transfer_continue(t);
+				}
+				continue;
+			}
+			wake_idle_worker();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief A fixed pool of threads that steal large transfers from each other.
+ */
+static void run_steal(int sfd) {
+	if(conn_queue_init(&queue, config.queue_slots) < 0) {
+		perror("could not allocate connection queue");
+		exit(EXIT_FAILURE);
+	}
+	steal_workers = calloc(config.workers, sizeof(StealWorker));
+	if(steal_workers == NULL) {
+		perror("could not allocate the steal workers");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < config.workers; i++) {
+		if(work_deque_init(&steal_workers[i].deque, 64) < 0) {
+			perror("could not allocate a work deque");
+			exit(EXIT_FAILURE);
+		}
+		steal_workers[i].seed = i + 1;
+		steal_workers[i].fresh_first = 1;
+	}
+	for(int i = 0; i < config.workers; i++) {
+		pthread_t tid;
+		if(pthread_create(&tid, NULL, steal_worker, &steal_workers[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(tid);
+	}
+
+	for(;;) {
+		if(queue_connection(accept_client(sfd)) == 0) {
+			wake_idle_worker();
+		}
+	}
+}
+
+/**
+ * @brief Serve one connection on a coroutine.
+ */
+static void coro_connection(int connfd) {
+	handle_client_connection(connfd, cache);
+}
+
+static void* coro_worker(void* args) {
+	place_worker();
+	coro_run((int)(intptr_t)args, config.coro_stack, coro_connection);
+	return NULL;
+}
+
+/**
+ * @brief A coroutine per connection, on an epoll reactor per worker thread.
+ */
+static void run_coro(int sfd) {
+	fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
+	//the main thread is one of the workers
+	for(int i = 1; i < config.workers; i++) {
+		pthread_t tid;
+		if(pthread_create(&tid, NULL, coro_worker, (void*)(intptr_t)sfd) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(tid);
+	}
+	place_worker();
+	coro_run(sfd, config.coro_stack, coro_connection);
+}
+
+int server_main(int argc, char** argv, const char* stats_log, const char* presets[][2]) {
+	config_init(&config, stats_log);
+	for(int i = 0; presets[i][0] != NULL; i++) {
+		if(config_set(&config, presets[i][0], presets[i][1]) < 0) {
+			fprintf(stderr, "bad preset %s=%s\n", presets[i][0], presets[i][1]);
+			return EXIT_FAILURE;
+		}
+	}
+	config_parse_args(&config, argc, argv);
+
+	//Before anything is allocated from the Slab, which splits by node
+	if(config.numa && numa_init() > 1) {
+		fprintf(stderr, "numa nodes=%d\n", numa_nodes());
+	}
+
+	// open the log file
+	if(stats_open(config.stats_log) < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if(config.mime_types != NULL && mime_load(config.mime_types) < 0) {
+		exit(EXIT_FAILURE);
+	}
+	if(warmup_prepare() < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	//The log lives relative to where we were started, files are
+	//served relative to the docroot
+	if(config.docroot != NULL && chdir(config.docroot) == -1)
+	{
+		perror(config.docroot);
+		exit(EXIT_FAILURE);
+	}
+
+	//Forked children would each have their own copy of the negative
+	//and fd caches, gone with the connection
+	int shared = config.model != MODEL_PROC;
+	if(fd_cache_init(shared ? config.fd_cache_entries : 0, !config.watch) < 0) {
+		perror("could not open the docroot");
+		exit(EXIT_FAILURE);
+	}
+
+	// Initialize cache
+	if(config.cache != CACHE_NONE) {
+		cache = cache_create(&config);
+		if(cache == NULL) {
+			perror("could not allocate memory for the cache");
+			exit(EXIT_FAILURE);
+		}
+		//Before any other thread, see Warmup.h
+		if(warmup_start(cache) < 0) {
+			perror("could not start the cache warm-up");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(shared && negative_cache_init(config.neg_cache_entries, config.neg_cache_ttl, !config.watch) < 0) {
+		perror("could not allocate memory for the negative cache");
+		exit(EXIT_FAILURE);
+	}
+	if((cache != NULL || (shared && (config.neg_cache_entries > 0 || config.fd_cache_entries > 0)))
+	   && watcher_start(cache) < 0) {
+		perror("could not start the cache watcher");
+		exit(EXIT_FAILURE);
+	}
+
+	//A client hanging up mid-response must not take the server down
+	signal(SIGPIPE, SIG_IGN);
+
+	//Before fork(), so children share the count
+	if(admission_init() < 0) {
+		perror("could not set up admission control");
+		exit(EXIT_FAILURE);
+	}
+
+	if(config.model != MODEL_PROC && timeouts_start() < 0) {
+		perror("could not start the timeout thread");
+		exit(EXIT_FAILURE);
+	}
+	//A forked child has only the one connection to hold up
+	if(config.model != MODEL_PROC && disk_pool_start() < 0) {
+		perror("could not start the disk threads");
+		exit(EXIT_FAILURE);
+	}
+
+	int sfd = open_listen_socket();
+	fprintf(stderr, "model=%s cache=%s workers=%d\n",
+		model_name(config.model), cache_name(config.cache), config.workers);
+
+	//A server's gotta serve...
+	switch(config.model) {
+	case MODEL_PROC:   run_proc(sfd);   break;
+	case MODEL_THREAD: run_thread(sfd); break;
+	case MODEL_POOL:   run_pool(sfd);   break;
+	case MODEL_EPOLL:  run_epoll(sfd);  break;
+	case MODEL_STEAL:  run_steal(sfd);  break;
+	case MODEL_CORO:   run_coro(sfd);   break;
+	}
+
+	//clean up
+	close(sfd);
+	return EXIT_FAILURE;
+}
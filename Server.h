@@ -0,0 +1,27 @@
+/**
+ * @file Server.h
+ * @brief Socket setup and the concurrency models.
+ *
+ * @author Dr. Jonathan Misurda
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/**
+ * @brief Parse the options, set up the server and serve forever.
+ *
+ * Every server binary is a call to this. `presets` are applied before
+ * the command line, so they act as that binary's defaults.
+ *
+ * @param argc From main().
+ * @param argv From main().
+ * @param stats_log The default timing log.
+ * @param presets Pairs of {option name, value}, ending with {NULL, NULL}.
+ * @return Only returns on failure.
+ */
+int server_main(int argc, char** argv, const char* stats_log, const char* presets[][2]);
+
+#endif
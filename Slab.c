@@ -0,0 +1,261 @@
+/**
+ * @file Slab.c
+ * @brief A size-classed pool for long-lived allocations such as cache entries.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "Slab.h"
+#include "Numa.h"
+#include "Config.h"
+
+enum {
+	SLAB_MIN_SHIFT = 6,                              // smallest class is 64 bytes
+	SLAB_MAX_SHIFT = 22,                             // largest class is 4 MB
+	SLAB_STEPS = 4,                                  // classes per power of two
+	SLAB_CLASSES = (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT) * SLAB_STEPS + 1,
+	SLAB_RETAIN_BYTES = 8 * 1024 * 1024,             // max idle bytes kept per class and node
+	SLAB_MAPPED = -2                                 // size_class of a block with a mapping of its own
+};
+
+/* With --huge-pages, blocks are carved from chunks this big. */
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define SLAB_CHUNK_SIZE (16 * HUGE_PAGE_SIZE)
+
+/**
+ * @brief Sits in front of every block.
+ *
+ * 16 bytes, so the block after it stays 16-byte aligned.
+ */
+typedef struct SlabHeader {
+	union {
+		struct SlabHeader* next_free; // only meaningful while on a free list
+		size_t mapped;                // length of a SLAB_MAPPED block's mapping
+	};
+	int size_class;               // -1 if it came straight from malloc()
+	int node;                     // whose free list it goes back to
+} SlabHeader;
+
+typedef struct SlabClass {
+	pthread_mutex_t mutex;
+	SlabHeader* free_list;
+	size_t size;
+	int free_count;
+	int max_free;
+} SlabClass;
+
+/**
+ * @struct SlabChunk
+ * @brief The huge-page chunk a node's new blocks are being carved from.
+ */
+typedef struct SlabChunk {
+	pthread_mutex_t mutex;
+	char* next;
+	char* end;
+} SlabChunk;
+
+// A set of classes per NUMA node, so a recycled block is always local
+// to the thread it is handed to
+static SlabClass (*nodes)[SLAB_CLASSES];
+static SlabClass node0_classes[SLAB_CLASSES];
+static SlabChunk* chunks;      // per node, with --huge-pages only
+static int node_count;
+static HugePages huge_pages;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+
+static void slab_init(void) {
+	node_count = numa_nodes();
+	nodes = node_count > 1 ? calloc(node_count, sizeof(*nodes)) : NULL;
+	if(nodes == NULL) {
+		node_count = 1;
+		nodes = &node0_classes;
+	}
+	huge_pages = config.huge_pages;
+	if(huge_pages != HUGE_PAGES_OFF) {
+		chunks = calloc(node_count, sizeof(SlabChunk));
+		if(chunks == NULL) {
+			huge_pages = HUGE_PAGES_OFF;
+		}
+		for(int n = 0; chunks != NULL && n < node_count; n++) {
+			pthread_mutex_init(&chunks[n].mutex, NULL);
+		}
+	}
+	for(int n = 0; n < node_count; n++) {
+		SlabClass* classes = nodes[n];
+		int c = 0;
+		classes[c++].size = (size_t)1 << SLAB_MIN_SHIFT;
+		for(int shift = SLAB_MIN_SHIFT; shift < SLAB_MAX_SHIFT; shift++) {
+			size_t base = (size_t)1 << shift;
+			for(int step = 1; step <= SLAB_STEPS; step++) {
+				classes[c++].size = base + step * (base / SLAB_STEPS);
+			}
+		}
+		for(c = 0; c < SLAB_CLASSES; c++) {
+			pthread_mutex_init(&classes[c].mutex, NULL);
+			classes[c].free_list = NULL;
+			classes[c].free_count = 0;
+			classes[c].max_free = SLAB_RETAIN_BYTES / classes[c].size;
+			if(classes[c].max_free < 2) {
+				classes[c].max_free = 2;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Binary search for the smallest class that fits size.
+ *
+ * @return The class index, or -1 if size is above the largest class.
+ */
+static int size_class(const SlabClass* classes, size_t size) {
+	if(size > classes[SLAB_CLASSES - 1].size) {
+		return -1;
+	}
+	int lo = 0, hi = SLAB_CLASSES - 1;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(classes[mid].size < size) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/**
+ * @brief Map len bytes (a multiple of HUGE_PAGE_SIZE) backed by huge pages.
+ *
+ * Reserved huge pages (MAP_HUGETLB) if asked for and there are any
+ * left, otherwise transparent huge pages on an aligned mapping.
+ *
+ * @return The mapping, or NULL.
+ */
+static void* map_huge(size_t len, int node) {
+	void* p = MAP_FAILED;
+	if(huge_pages == HUGE_PAGES_HUGETLB) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p == MAP_FAILED) {
+			static int warned;
+			if(!warned) {
+				warned = 1;
+				perror("no reserved huge pages left (vm.nr_hugepages), using transparent ones");
+			}
+		}
+	}
+	if(p == MAP_FAILED) {
+		//A THP can only back a 2 MB aligned 2 MB range, so map a
+		//page extra and trim it to alignment
+		char* raw = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(raw == MAP_FAILED) {
+			return NULL;
+		}
+		char* aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+		if(aligned > raw) {
+			munmap(raw, aligned - raw);
+		}
+		munmap(aligned + len, raw + HUGE_PAGE_SIZE - aligned);
+		madvise(aligned, len, MADV_HUGEPAGE);
+		p = aligned;
+	}
+	//Before anything touches it, so nothing has to move
+	numa_bind(p, len, node);
+	return p;
+}
+
+/**
+ * @brief Carve a new block out of the node's current chunk.
+ *
+ * Carved blocks never go back to the system, only to a free list; the
+ * rest of a chunk too small for the next block is left unused.
+ */
+static SlabHeader* carve(size_t len, int node) {
+	SlabChunk* chunk = &chunks[node];
+	pthread_mutex_lock(&chunk->mutex);
+	if(chunk->next == NULL || (size_t)(chunk->end - chunk->next) < len) {
+		char* p = map_huge(SLAB_CHUNK_SIZE, node);
+		if(p == NULL) {
+			pthread_mutex_unlock(&chunk->mutex);
+			return NULL;
+		}
+		chunk->next = p;
+		chunk->end = p + SLAB_CHUNK_SIZE;
+	}
+	SlabHeader* h = (SlabHeader*)chunk->next;
+	chunk->next += len;
+	pthread_mutex_unlock(&chunk->mutex);
+	return h;
+}
+
+void* slab_alloc(size_t size) {
+	pthread_once(&slab_once, slab_init);
+
+	int node = node_count > 1 ? numa_node() % node_count : 0;
+	int c = size_class(nodes[node], size);
+	SlabHeader* h = NULL;
+	if(c >= 0) {
+		SlabClass* sc = &nodes[node][c];
+		pthread_mutex_lock(&sc->mutex);
+		h = sc->free_list;
+		if(h != NULL) {
+			sc->free_list = h->next_free;
+			sc->free_count--;
+		}
+		pthread_mutex_unlock(&sc->mutex);
+		if(h == NULL && huge_pages != HUGE_PAGES_OFF) {
+			h = carve(sizeof(SlabHeader) + sc->size, node);
+		} else if(h == NULL) {
+			//Heap pages are shared with other allocations, so they are
+			//not bound; the pinned worker touching them first places them
+			size = sc->size;
+			h = malloc(sizeof(SlabHeader) + size);
+		}
+	} else if(huge_pages != HUGE_PAGES_OFF) {
+		size_t len = (sizeof(SlabHeader) + size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+		h = map_huge(len, node);
+		if(h != NULL) {
+			h->mapped = len;
+			c = SLAB_MAPPED;
+		}
+	} else {
+		h = malloc(sizeof(SlabHeader) + size);
+	}
+	if(h == NULL) {
+		return NULL;
+	}
+	h->size_class = c;
+	h->node = node;
+	return h + 1;
+}
+
+void slab_free(void* p) {
+	if(p == NULL) {
+		return;
+	}
+	SlabHeader* h = (SlabHeader*)p - 1;
+	if(h->size_class == SLAB_MAPPED) {
+		munmap(h, h->mapped);
+		return;
+	}
+	if(h->size_class < 0) {
+		free(h);
+		return;
+	}
+	SlabClass* sc = &nodes[h->node][h->size_class];
+	pthread_mutex_lock(&sc->mutex);
+	//A carved block can't be given back on its own, so it stays
+	if(huge_pages != HUGE_PAGES_OFF || sc->free_count < sc->max_free) {
+		h->next_free = sc->free_list;
+		sc->free_list = h;
+		sc->free_count++;
+		h = NULL;
+	}
+	pthread_mutex_unlock(&sc->mutex);
+	free(h);
+}
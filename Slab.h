@@ -0,0 +1,47 @@
+/**
+ * @file Slab.h
+ * @brief A size-classed pool for long-lived allocations such as cache entries.
+ *
+ * Sizes are rounded up to one of a set of classes, four per power of
+ * two, so at most a quarter of a block is wasted. Freed blocks go on a
+ * per-class free list and are handed out again to the next allocation
+ * of the same class instead of going back to malloc(), which keeps
+ * cache churn from fragmenting the heap. Each class has its own lock,
+ * so threads caching different sizes don't contend.
+ *
+ * Allocations above the largest class go straight to malloc().
+ *
+ * On a NUMA machine each node has its own classes: a block comes from
+ * the allocating thread's node, and goes back to the same node's free
+ * list wherever it is freed. Blocks from malloc() are placed by the
+ * kernel when the pinned worker first touches them; only huge-page
+ * chunks, which the slab maps itself, are bound to a node explicitly.
+ *
+ * With --huge-pages, new blocks are carved from 32 MB chunks backed by
+ * 2 MB pages instead of coming from malloc(), so a large cache costs
+ * one TLB entry per 2 MB of bodies rather than per 4 KB. Carved blocks
+ * are never returned to the system: memory stays at the high-water
+ * mark of what was cached, in whole chunks that show up as
+ * AnonHugePages (or HugePages_*) on their own. Allocations above the
+ * largest class get a huge-page mapping of their own.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/**
+ * @return size bytes aligned for any type, or NULL.
+ */
+void* slab_alloc(size_t size);
+
+/**
+ * @brief Return a block from slab_alloc(). NULL is ignored.
+ */
+void slab_free(void* p);
+
+#endif
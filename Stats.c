@@ -0,0 +1,103 @@
+/**
+ * @file Stats.c
+ * @brief The per-request timing log.
+ *
+ * The lock lives in shared memory so that forked children and threads
+ * serialize on the same mutex.
+ *
+ * @author Dr. Jonathan Misurda
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "Stats.h"
+
+static FILE* stats_txt;
+static pthread_mutex_t* stats_mutex;
+
+enum { NS_PER_SECOND = 1000000000 };
+
+/**
+ * @brief subtract two timespecs.
+ *
+ * Credit goes to user `chux` on stackoverflow.
+ * https://stackoverflow.com/questions/68804469/subtract-two-timespec-objects-find-difference-in-time-or-duration
+ *
+ * td = t1 - t2
+ *
+ * @param t1 The first timespec.
+ * @param t2 The second timesepc.
+ * @param td Timespec struct to hold the result.
+ */
+void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td)
+{
+    td->tv_nsec = t2.tv_nsec - t1.tv_nsec;
+    td->tv_sec  = t2.tv_sec - t1.tv_sec;
+    if (td->tv_sec > 0 && td->tv_nsec < 0)
+    {
+        td->tv_nsec += NS_PER_SECOND;
+        td->tv_sec--;
+    }
+    else if (td->tv_sec < 0 && td->tv_nsec > 0)
+    {
+        td->tv_nsec -= NS_PER_SECOND;
+        td->tv_sec++;
+    }
+}
+
+int stats_open(const char* path) {
+	// allocate memory for the mutex so that children share it
+	stats_mutex = mmap(NULL, sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(stats_mutex == MAP_FAILED) {
+		perror("could not allocate memory for log mutex");
+		return -1;
+	}
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(stats_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	// open the log file for appending
+	stats_txt = fopen(path, "a");
+	if(stats_txt == NULL) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+void stats_start(struct timespec* start) {
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+void stats_log(const char* filename, long bytes, const struct timespec* start) {
+	struct timespec finish, delta;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &finish);
+	sub_timespec(*start, finish, &delta);
+	stats_log_total(filename, bytes, &delta);
+}
+
+void stats_add(struct timespec* total, const struct timespec* start) {
+	struct timespec finish, delta;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &finish);
+	sub_timespec(*start, finish, &delta);
+	total->tv_sec += delta.tv_sec;
+	total->tv_nsec += delta.tv_nsec;
+	if(total->tv_nsec >= NS_PER_SECOND) {
+		total->tv_nsec -= NS_PER_SECOND;
+		total->tv_sec++;
+	}
+}
+
+void stats_log_total(const char* filename, long bytes, const struct timespec* total) {
+	pthread_mutex_lock(stats_mutex);
+	fprintf(stats_txt, "%s\t%ld\t%d.%.9ld\n", filename, bytes, (int)total->tv_sec, total->tv_nsec);
+	fflush(stats_txt);
+	pthread_mutex_unlock(stats_mutex);
+}
@@ -0,0 +1,54 @@
+/**
+ * @file Stats.h
+ * @brief The per-request timing log.
+ *
+ * One line per response: filename, bytes sent and the CPU time spent
+ * by the handling thread, tab separated. The log is safe to write from
+ * threads and from forked children alike.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+/**
+ * @brief Open (append to) the timing log.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int stats_open(const char* path);
+
+/**
+ * @brief Start timing a request on the calling thread.
+ */
+void stats_start(struct timespec* start);
+
+/**
+ * @brief Write one line to the timing log.
+ *
+ * @param filename The file that was served.
+ * @param bytes The number of body bytes sent.
+ * @param start The time taken by stats_start().
+ */
+void stats_log(const char* filename, long bytes, const struct timespec* start);
+
+/**
+ * @brief Add the time the calling thread has taken since start to total.
+ *
+ * For a response sent in pieces by several threads, whose CPU clocks
+ * can't be compared with each other.
+ */
+void stats_add(struct timespec* total, const struct timespec* start);
+
+/**
+ * @brief Write one line to the timing log, with a time added up by stats_add().
+ */
+void stats_log_total(const char* filename, long bytes, const struct timespec* total);
+
+void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td);
+
+#endif
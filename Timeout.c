@@ -0,0 +1,193 @@
+/**
+ * @file Timeout.c
+ * @brief Deadlines that stop slow or silent clients from holding a worker.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include "Timeout.h"
+#include "TimerWheel.h"
+#include "Config.h"
+
+/**
+ * @struct ConnTimer
+ * @brief The deadline of whatever connection has a file descriptor.
+ *
+ * Allocated the first time the descriptor is used, then kept for
+ * every later connection that gets the same number.
+ */
+typedef struct ConnTimer {
+	Timer timer;               // first, so the Timer is the ConnTimer
+	int fd;
+	int sending;               // progress extends the deadline
+	atomic_long deadline;      // ms, CLOCK_MONOTONIC; 0 = none
+} ConnTimer;
+
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TimerWheel wheel;
+static _Atomic(ConnTimer*)* timers;  // by file descriptor
+static long timer_count;
+
+static long now_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Arm for the current deadline. Called with wheel_mutex held.
+ */
+static void arm(ConnTimer* t) {
+	long deadline = atomic_load_explicit(&t->deadline, memory_order_relaxed);
+	timer_wheel_arm(&wheel, &t->timer, (deadline + TIMEOUT_TICK_MS - 1) / TIMEOUT_TICK_MS);
+}
+
+/**
+ * @brief The old deadline came round. Called with wheel_mutex held.
+ */
+static void fire(Timer* timer) {
+	ConnTimer* t = (ConnTimer*)timer;
+	long deadline = atomic_load_explicit(&t->deadline, memory_order_relaxed);
+	if(deadline == 0) {
+		return;
+	}
+	if(deadline > now_ms()) {
+		//progress moved it on since it was armed
+		arm(t);
+		return;
+	}
+	//The owner can't close the descriptor before it has taken
+	//wheel_mutex to forget it, so this is still its connection.
+	//A zero linger makes the owner's close() reset it rather than
+	//leave whatever is still queued draining to the slow peer.
+	struct linger reset = { 1, 0 };
+	atomic_store_explicit(&t->deadline, 0, memory_order_relaxed);
+	setsockopt(t->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+	shutdown(t->fd, SHUT_RDWR);
+}
+
+static void* tick_thread(void* arg) {
+	struct timespec tick = { 0, TIMEOUT_TICK_MS * 1000000L };
+	for(;;) {
+		nanosleep(&tick, NULL);
+		pthread_mutex_lock(&wheel_mutex);
+		timer_wheel_advance(&wheel, now_ms() / TIMEOUT_TICK_MS);
+		pthread_mutex_unlock(&wheel_mutex);
+	}
+	return NULL;
+}
+
+int timeouts_start(void) {
+	if(config.header_timeout == 0 && config.send_timeout == 0) {
+		return 0;
+	}
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+		return -1;
+	}
+	long count = limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > 1 << 22 ? 1 << 22 : (long)limit.rlim_cur;
+	_Atomic(ConnTimer*)* table = calloc(count, sizeof(*table));
+	if(table == NULL) {
+		return -1;
+	}
+	timer_wheel_init(&wheel, now_ms() / TIMEOUT_TICK_MS);
+
+	pthread_t tid;
+	if(pthread_create(&tid, NULL, tick_thread, NULL) != 0) {
+		free(table);
+		return -1;
+	}
+	pthread_detach(tid);
+	//Before any connection is served, so no one reads these meanwhile
+	timer_count = count;
+	timers = table;
+	return 0;
+}
+
+/**
+ * @brief The timer for connfd, allocating it the first time.
+ *
+ * @return The timer, or NULL if timeouts are off.
+ */
+static ConnTimer* timer_for(int connfd) {
+	if(timers == NULL || connfd < 0 || connfd >= timer_count) {
+		return NULL;
+	}
+	ConnTimer* t = atomic_load_explicit(&timers[connfd], memory_order_acquire);
+	if(t == NULL) {
+		//Only the connection's owner gets here, so there is no race
+		//for the slot
+		t = calloc(1, sizeof(ConnTimer));
+		if(t == NULL) {
+			return NULL;
+		}
+		t->timer.fire = fire;
+		t->fd = connfd;
+		atomic_store_explicit(&timers[connfd], t, memory_order_release);
+	}
+	return t;
+}
+
+/**
+ * @brief Set a new deadline, seconds from now.
+ */
+static void set_deadline(int connfd, int seconds, int sending) {
+	ConnTimer* t = timer_for(connfd);
+	if(t == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&wheel_mutex);
+	t->sending = sending;
+	if(seconds > 0) {
+		atomic_store_explicit(&t->deadline, now_ms() + seconds * 1000L, memory_order_relaxed);
+		arm(t);
+	} else {
+		atomic_store_explicit(&t->deadline, 0, memory_order_relaxed);
+		timer_wheel_cancel(&t->timer);
+	}
+	pthread_mutex_unlock(&wheel_mutex);
+}
+
+void connection_expect_request(int connfd) {
+	set_deadline(connfd, config.header_timeout, 0);
+}
+
+void connection_start_sending(int connfd) {
+	set_deadline(connfd, config.send_timeout, 1);
+}
+
+void connection_progress(int connfd, long bytes) {
+	if(timers == NULL || connfd < 0 || connfd >= timer_count || config.send_timeout == 0) {
+		return;
+	}
+	ConnTimer* t = atomic_load_explicit(&timers[connfd], memory_order_acquire);
+	if(t == NULL || !t->sending) {
+		return;
+	}
+	//Each byte buys 1/min_send_rate seconds, but never more than
+	//send_timeout seconds of slack from now
+	long deadline = atomic_load_explicit(&t->deadline, memory_order_relaxed);
+	if(deadline == 0) {
+		return;
+	}
+	long credit = config.min_send_rate > 0 ? bytes * 1000 / config.min_send_rate : config.send_timeout * 1000L;
+	long latest = now_ms() + config.send_timeout * 1000L;
+	long next = deadline + credit < latest ? deadline + credit : latest;
+	//Only this connection's owner moves it forward; the fire() that
+	//zeroes it is after it for good anyway
+	atomic_compare_exchange_strong_explicit(&t->deadline, &deadline, next,
+	                                        memory_order_relaxed, memory_order_relaxed);
+}
+
+void connection_forget(int connfd) {
+	set_deadline(connfd, 0, 0);
+}
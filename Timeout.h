@@ -0,0 +1,60 @@
+/**
+ * @file Timeout.h
+ * @brief Deadlines that stop slow or silent clients from holding a worker.
+ *
+ * Every connection gets --header-timeout seconds to send its request.
+ * Then, while the response goes out, it must keep taking at least
+ * --min-send-rate bytes a second on average, and never stall for more
+ * than --send-timeout seconds. A connection that misses its deadline
+ * is shut down, which wakes whatever is blocked on it (a recv(), a
+ * send(), an epoll wait) with an error, so the usual error paths clean
+ * it up.
+ *
+ * Deadlines live in a TimerWheel, ticked every TIMEOUT_TICK_MS by a
+ * thread of its own, with a timer per file descriptor. Progress only
+ * updates an atomic deadline; the wheel catches up lazily when the
+ * old deadline comes round, so sends never take its lock.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+
+/* Resolution of every deadline. */
+#define TIMEOUT_TICK_MS 100
+
+/**
+ * @brief Start the ticking thread.
+ *
+ * Until then, and in processes where it isn't called, the other
+ * functions do nothing. A forked child must call it itself.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int timeouts_start(void);
+
+/**
+ * @brief Give a new connection --header-timeout to send its request.
+ */
+void connection_expect_request(int connfd);
+
+/**
+ * @brief The request is in; the response must now keep moving.
+ */
+void connection_start_sending(int connfd);
+
+/**
+ * @brief Credit a connection for bytes it has taken.
+ *
+ * Lock-free, cheap enough to call after every send().
+ */
+void connection_progress(int connfd, long bytes);
+
+/**
+ * @brief Drop a connection's deadline. Must be called before it is closed.
+ */
+void connection_forget(int connfd);
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * @file TimerWheel.c
+ * @brief A hierarchical timing wheel.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include "TimerWheel.h"
+
+static void list_init(Timer* head) {
+	head->prev = head;
+	head->next = head;
+}
+
+void timer_wheel_init(TimerWheel* wheel, unsigned long now) {
+	wheel->now = now;
+	for(int level = 0; level < WHEEL_LEVELS; level++) {
+		for(int slot = 0; slot < WHEEL_SLOTS; slot++) {
+			list_init(&wheel->slots[level][slot]);
+		}
+	}
+}
+
+void timer_wheel_cancel(Timer* timer) {
+	if(timer->prev == NULL) {
+		return;
+	}
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+/**
+ * @brief Link a disarmed timer into the slot for its expiry.
+ *
+ * An expiry of now goes in the current level 0 slot, which is only
+ * right while advancing, before that slot is fired.
+ */
+static void place(TimerWheel* wheel, Timer* timer, unsigned long expires) {
+	unsigned long delta = expires - wheel->now;
+	int level = 0;
+	while(level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1))) {
+		level++;
+	}
+	if(delta >= 1UL << (WHEEL_BITS * WHEEL_LEVELS)) {
+		expires = wheel->now + (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	}
+	timer->expires = expires;
+
+	Timer* head = &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+	timer->prev = head->prev;
+	timer->next = head;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+void timer_wheel_arm(TimerWheel* wheel, Timer* timer, unsigned long expires) {
+	timer_wheel_cancel(timer);
+	if(expires <= wheel->now) {
+		expires = wheel->now + 1;
+	}
+	place(wheel, timer, expires);
+}
+
+/**
+ * @brief Take every timer out of a slot, as a NULL-terminated list.
+ */
+static Timer* take_slot(Timer* head) {
+	if(head->next == head) {
+		return NULL;
+	}
+	Timer* first = head->next;
+	head->prev->next = NULL;
+	list_init(head);
+	return first;
+}
+
+void timer_wheel_advance(TimerWheel* wheel, unsigned long now) {
+	while(wheel->now < now) {
+		wheel->now++;
+
+		//Every 64 ticks, the next run of 64 comes down from level 1,
+		//and so on up whenever a level wraps around too. None of them
+		//can land back in the slot being emptied.
+		for(int level = 1; level < WHEEL_LEVELS; level++) {
+			if(wheel->now & ((1UL << (WHEEL_BITS * level)) - 1)) {
+				break;
+			}
+			Timer* timer = take_slot(&wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)]);
+			while(timer != NULL) {
+				Timer* next = timer->next;
+				place(wheel, timer, timer->expires);
+				timer = next;
+			}
+		}
+
+		Timer* timer = take_slot(&wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)]);
+		while(timer != NULL) {
+			Timer* next = timer->next;
+			timer->prev = NULL;
+			timer->next = NULL;
+			timer->fire(timer);
+			timer = next;
+		}
+	}
+}
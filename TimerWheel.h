@@ -0,0 +1,66 @@
+/**
+ * @file TimerWheel.h
+ * @brief A hierarchical timing wheel.
+ *
+ * Time is counted in ticks. Level 0 has a slot for each of the next 64
+ * ticks, level 1 a slot for each of the next 64 runs of 64 ticks, and
+ * so on. Arming and cancelling a timer are O(1): it is linked into, or
+ * out of, the slot its expiry falls in. As time reaches a higher-level
+ * slot, its timers are spread out over the levels below it, so each
+ * timer is moved at most once per level before it fires.
+ *
+ * The wheel doesn't lock; Timeout.c holds a mutex around it.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+typedef struct Timer {
+	struct Timer* prev;     // NULL while not armed
+	struct Timer* next;
+	unsigned long expires;  // tick it fires at
+	void (*fire)(struct Timer* timer);
+} Timer;
+
+typedef struct TimerWheel {
+	unsigned long now;      // the last tick advanced to
+	Timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // list heads
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, unsigned long now);
+
+/**
+ * @brief Arm a timer, or move it if it is already armed.
+ *
+ * A tick that has already passed fires on the next one. Expiries past
+ * the last level are brought in to the end of it.
+ */
+void timer_wheel_arm(TimerWheel* wheel, Timer* timer, unsigned long expires);
+
+/**
+ * @brief Disarm a timer. Does nothing if it isn't armed.
+ */
+void timer_wheel_cancel(Timer* timer);
+
+static inline int timer_armed(const Timer* timer) {
+	return timer->prev != NULL;
+}
+
+/**
+ * @brief Fire every timer due up to and including tick now.
+ *
+ * Each is disarmed before its fire() is called, which may arm it again
+ * but must not touch any other timer.
+ */
+void timer_wheel_advance(TimerWheel* wheel, unsigned long now);
+
+#endif
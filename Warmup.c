@@ -0,0 +1,295 @@
+/**
+ * @file Warmup.c
+ * @brief Filling the cache at startup, and remembering it at shutdown.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "Warmup.h"
+#include "Config.h"
+#include "Http.h"
+#include "HttpResponse.h"
+#include "Request.h"
+
+/**
+ * @struct Name
+ * @brief A candidate file and how often it was requested.
+ */
+typedef struct Name {
+	char* name;
+	long count;   // requests in the stats log
+	long first;   // order of first appearance, to break ties
+} Name;
+
+/* Open addressing, kept at most half full. */
+static Name* table;
+static long table_size;
+static long name_count;
+
+/* The files to load, best first, and the next one to hand out. */
+static char** files;
+static long file_count;
+static atomic_long next_file;
+static atomic_int loaders_running;
+static atomic_long loaded;
+
+/* Absolute, since we chdir() after warmup_prepare(). */
+static char* save_path;
+
+static Name* find_name(const char* name) {
+	unsigned long slot = http_response_hash(name) & (table_size - 1);
+	while(table[slot].name != NULL && strcmp(table[slot].name, name) != 0) {
+		slot = (slot + 1) & (table_size - 1);
+	}
+	return &table[slot];
+}
+
+static int add_name(const char* name, long count) {
+	if(name_count * 2 >= table_size) {
+		long old_size = table_size;
+		Name* old = table;
+		table_size = old_size ? old_size * 2 : 1024;
+		table = calloc(table_size, sizeof(Name));
+		if(table == NULL) {
+			table = old;
+			table_size = old_size;
+			return -1;
+		}
+		for(long i = 0; i < old_size; i++) {
+			if(old[i].name != NULL) {
+				*find_name(old[i].name) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	Name* slot = find_name(name);
+	if(slot->name == NULL) {
+		slot->name = strdup(name);
+		if(slot->name == NULL) {
+			return -1;
+		}
+		slot->first = name_count++;
+	}
+	slot->count += count;
+	return 0;
+}
+
+/**
+ * @brief Add every line of a manifest, or the first field of every
+ * line of a stats log.
+ *
+ * @param count What each line adds to its file's count: 0 for a
+ *              manifest, which keeps its order, and 1 for a log.
+ */
+static int read_names(const char* path, long count) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) {
+		perror(path);
+		return -1;
+	}
+	char line[4096];
+	while(fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\t\r\n")] = '\0';
+		if(line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+		//Keyed the way a request for it would be, so "./a.html" and
+		//"/a.html" warm "a.html", and ".." can't leave the docroot
+		if(normalize_path(line) < 0 || line[0] == '\0') {
+			continue;
+		}
+		if(add_name(line, count) < 0) {
+			perror("could not allocate the warm-up list");
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * @brief Most requested first; the manifest, with no counts, in order.
+ */
+static int compare_names(const void* a, const void* b) {
+	const Name* x = a;
+	const Name* y = b;
+	if(x->count != y->count) {
+		return x->count < y->count ? 1 : -1;
+	}
+	return x->first < y->first ? -1 : x->first > y->first;
+}
+
+int warmup_prepare(void) {
+	if(config.warm_save != NULL) {
+		if(config.warm_save[0] == '/') {
+			save_path = strdup(config.warm_save);
+		} else {
+			char cwd[4096];
+			if(getcwd(cwd, sizeof(cwd)) == NULL) {
+				perror("getcwd");
+				return -1;
+			}
+			save_path = malloc(strlen(cwd) + strlen(config.warm_save) + 2);
+			if(save_path != NULL) {
+				sprintf(save_path, "%s/%s", cwd, config.warm_save);
+			}
+		}
+		if(save_path == NULL) {
+			perror("could not allocate the warm-up save path");
+			return -1;
+		}
+	}
+
+	// Names from the log outrank the manifest's, which have count 0.
+	if(config.warm_log != NULL && read_names(config.warm_log, 1) < 0) {
+		return -1;
+	}
+	if(config.warm_manifest != NULL && read_names(config.warm_manifest, 0) < 0) {
+		return -1;
+	}
+	if(name_count == 0) {
+		free(table);
+		table = NULL;
+		return 0;
+	}
+
+	Name* names = malloc(name_count * sizeof(Name));
+	if(names == NULL) {
+		perror("could not allocate the warm-up list");
+		return -1;
+	}
+	long n = 0;
+	for(long i = 0; i < table_size; i++) {
+		if(table[i].name != NULL) {
+			names[n++] = table[i];
+		}
+	}
+	qsort(names, n, sizeof(Name), compare_names);
+
+	// No point loading more than the cache can hold.
+	long top = config.warm_top > 0 ? config.warm_top : config.cache_entries;
+	file_count = n < top ? n : top;
+	files = malloc(file_count * sizeof(char*));
+	if(files == NULL) {
+		perror("could not allocate the warm-up list");
+		return -1;
+	}
+	for(long i = 0; i < n; i++) {
+		if(i < file_count) {
+			files[i] = names[i].name;
+		} else {
+			free(names[i].name);
+		}
+	}
+	free(names);
+	free(table);
+	table = NULL;
+	return 0;
+}
+
+static void* loader_thread(void* arg) {
+	Cache* cache = arg;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	long i;
+	while((i = atomic_fetch_add(&next_file, 1)) < file_count) {
+		if(preload_file(cache, files[i]) == 0) {
+			atomic_fetch_add(&loaded, 1);
+		}
+	}
+
+	// The last loader out reports
+	if(atomic_fetch_sub(&loaders_running, 1) == 1) {
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		fprintf(stderr, "warm-up: cached %ld of %ld files in %.3fs\n",
+			atomic_load(&loaded), file_count,
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	}
+	return NULL;
+}
+
+static void save_entry(HttpResponse* resp, void* arg) {
+	// Each encoding of a file is its own entry; the manifest only
+	// needs the file once, and loads the identity.
+	if(resp->encoding == ENCODING_IDENTITY) {
+		fprintf(arg, "%s\n", http_response_key(resp));
+	}
+}
+
+/**
+ * @brief Wait for SIGINT or SIGTERM, save the hot set and exit.
+ */
+static void* saver_thread(void* arg) {
+	Cache* cache = arg;
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	int sig;
+	sigwait(&signals, &sig);
+
+	// Write it next to the old one and swap, so a crash mid-write
+	// doesn't lose the last good manifest.
+	size_t len = strlen(save_path);
+	char* tmp = malloc(len + 5);
+	if(tmp != NULL) {
+		sprintf(tmp, "%s.tmp", save_path);
+		FILE* f = fopen(tmp, "w");
+		if(f == NULL) {
+			perror(tmp);
+		} else {
+			cache_for_each(cache, save_entry, f);
+			if(fclose(f) == 0 && rename(tmp, save_path) == 0) {
+				fprintf(stderr, "warm-up: saved the hot set to %s\n", save_path);
+			} else {
+				perror(save_path);
+			}
+		}
+		free(tmp);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+int warmup_start(Cache* cache) {
+	pthread_t tid;
+
+	if(save_path != NULL) {
+		// Threads inherit the mask, so from here on only the saver
+		// sees these signals.
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &signals, NULL);
+		if(pthread_create(&tid, NULL, saver_thread, cache) != 0) {
+			return -1;
+		}
+		pthread_detach(tid);
+	}
+
+	if(file_count == 0) {
+		return 0;
+	}
+	int threads = config.warm_threads < file_count ? config.warm_threads : (int)file_count;
+	atomic_store(&loaders_running, threads);
+	for(int i = 0; i < threads; i++) {
+		if(pthread_create(&tid, NULL, loader_thread, cache) != 0) {
+			return -1;
+		}
+		pthread_detach(tid);
+	}
+	return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file Warmup.h
+ * @brief Filling the cache at startup, and remembering it at shutdown.
+ *
+ * The files to load come from a manifest (one filename per line) and/or
+ * the N most requested files in a stats log from a previous run. They
+ * are read by a few loader threads while the server is already
+ * accepting, so a request for a file that isn't loaded yet is simply
+ * a miss. With --warm-save, the cached files are written out as a
+ * manifest on SIGINT or SIGTERM, ready for the next --warm-manifest.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include "Cache.h"
+
+/**
+ * @brief Read the list of files to load.
+ *
+ * Call before chdir() to the docroot, since the manifest, log and save
+ * paths are relative to where the server was started.
+ *
+ * @return 0 on success, -1 on error (already reported on stderr).
+ */
+int warmup_prepare(void);
+
+/**
+ * @brief Start loading, and start waiting for shutdown if --warm-save is set.
+ *
+ * Call before any other thread is created, so that SIGINT and SIGTERM
+ * reach only the thread that saves the hot set.
+ *
+ * @return 0 on success, -1 if a thread could not be started.
+ */
+int warmup_start(Cache* cache);
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * @file Watcher.c
+ * @brief Keeps the cache in step with the files on disk.
+ *
+ * That includes the negative cache, where a path remembered as missing
+ * is forgotten as soon as the file is created, and the files FdCache
+ * keeps open, which are closed as soon as they change.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include "Watcher.h"
+#include "Config.h"
+#include "Encoding.h"
+#include "NegativeCache.h"
+#include "FdCache.h"
+
+/* Anything that can change what a path serves. */
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE \
+                    | IN_CREATE | IN_ATTRIB | IN_ONLYDIR)
+
+/**
+ * @struct Watcher
+ * @brief The watcher thread's state.
+ */
+typedef struct Watcher {
+	Cache* cache;      // NULL if only the negative cache is being kept up to date
+	int fd;            // inotify instance, -1 if there is none
+	char** prefixes;   // by watch descriptor: the directory, relative to the docroot, with a trailing '/'
+	int prefix_count;
+} Watcher;
+
+/**
+ * @brief Watch a directory and everything under it.
+ *
+ * @param dir The directory, relative to the docroot ("" for the docroot).
+ */
+static void watch_tree(Watcher* w, const char* dir) {
+	const char* path = *dir ? dir : ".";
+	int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+	if(wd < 0) {
+		//Most likely out of watches; revalidation still covers it
+		fprintf(stderr, "inotify_add_watch %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	if(wd >= w->prefix_count) {
+		int count = w->prefix_count ? w->prefix_count : 64;
+		while(count <= wd) {
+			count *= 2;
+		}
+		char** prefixes = realloc(w->prefixes, count * sizeof(char*));
+		if(prefixes == NULL) {
+			return;
+		}
+		memset(prefixes + w->prefix_count, 0, (count - w->prefix_count) * sizeof(char*));
+		w->prefixes = prefixes;
+		w->prefix_count = count;
+	}
+	free(w->prefixes[wd]);
+	size_t len = strlen(dir);
+	w->prefixes[wd] = malloc(len + 2);
+	if(w->prefixes[wd] == NULL) {
+		return;
+	}
+	memcpy(w->prefixes[wd], dir, len);
+	strcpy(w->prefixes[wd] + len, len ? "/" : "");
+
+	DIR* d = opendir(path);
+	if(d == NULL) {
+		return;
+	}
+	struct dirent* entry;
+	while((entry = readdir(d)) != NULL) {
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		char child[4096];
+		if(snprintf(child, sizeof(child), "%s%s", w->prefixes[wd], entry->d_name) >= (int)sizeof(child)) {
+			continue;
+		}
+		struct stat st;
+		if(entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN
+		   && lstat(child, &st) == 0 && S_ISDIR(st.st_mode))) {
+			watch_tree(w, child);
+		}
+	}
+	closedir(d);
+}
+
+/**
+ * @brief Stop watching a directory that moved away or was deleted.
+ *
+ * Its subdirectories' watches go too, since their names are now wrong.
+ */
+static void unwatch_tree(Watcher* w, const char* dir) {
+	size_t len = strlen(dir);
+	for(int wd = 0; wd < w->prefix_count; wd++) {
+		char* prefix = w->prefixes[wd];
+		if(prefix != NULL && strncmp(prefix, dir, len) == 0 && prefix[len] == '/') {
+			inotify_rm_watch(w->fd, wd);
+			free(prefix);
+			w->prefixes[wd] = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Forget everything, when we can't tell what changed.
+ */
+static void invalidate_all(Watcher* w) {
+	negative_cache_clear();
+	fd_cache_clear();
+	if(w->cache != NULL) {
+		cache_clear(w->cache);
+	}
+}
+
+/**
+ * @brief Invalidate a changed file, and the file it is a precompressed sibling of.
+ */
+static void invalidate_path(Watcher* w, const char* path) {
+	negative_cache_invalidate(path);
+	fd_cache_invalidate(path);
+	if(w->cache == NULL) {
+		return;
+	}
+	cache_invalidate(w->cache, path);
+
+	size_t len = strlen(path);
+	for(int e = ENCODING_IDENTITY + 1; e < ENCODING_COUNT; e++) {
+		const char* suffix = encoding_suffix(e);
+		size_t suffix_len = strlen(suffix);
+		if(len > suffix_len && strcmp(path + len - suffix_len, suffix) == 0) {
+			char base[4096];
+			if(len - suffix_len < sizeof(base)) {
+				memcpy(base, path, len - suffix_len);
+				base[len - suffix_len] = '\0';
+				cache_invalidate(w->cache, base);
+			}
+		}
+	}
+}
+
+static void handle_event(Watcher* w, const struct inotify_event* event) {
+	if(event->mask & IN_Q_OVERFLOW) {
+		//We can't know what we missed
+		invalidate_all(w);
+		return;
+	}
+	if(event->mask & IN_IGNORED) {
+		if(event->wd < w->prefix_count) {
+			free(w->prefixes[event->wd]);
+			w->prefixes[event->wd] = NULL;
+		}
+		return;
+	}
+	if(event->len == 0 || event->wd >= w->prefix_count || w->prefixes[event->wd] == NULL) {
+		return;
+	}
+
+	char path[4096];
+	if(snprintf(path, sizeof(path), "%s%s", w->prefixes[event->wd], event->name) >= (int)sizeof(path)) {
+		return;
+	}
+
+	if(event->mask & IN_ISDIR) {
+		if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			watch_tree(w, path);
+			//Paths under it that were missing may not be any more
+			negative_cache_clear();
+		} else if(event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+			//Rather than hunt down every cached file under it
+			unwatch_tree(w, path);
+			invalidate_all(w);
+		}
+		return;
+	}
+
+	invalidate_path(w, path);
+}
+
+/**
+ * @brief Has the file behind a cache entry changed?
+ */
+static int is_stale(const HttpResponse* resp) {
+	struct stat st;
+	if(stat(http_response_key(resp), &st) < 0) {
+		return 1;
+	}
+	if(resp->encoding == ENCODING_IDENTITY) {
+		return st.st_mtime != resp->mtime || (unsigned long)st.st_size != resp->filesize
+		       || st.st_ino != resp->ino;
+	}
+	//A compressed variant only knows the file it came from wasn't
+	//newer than itself
+	return st.st_mtime > resp->mtime;
+}
+
+static void* watcher_thread(void* arg) {
+	Watcher* w = arg;
+	//Events are at most NAME_MAX + 1 past the header
+	char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	next.tv_sec += config.revalidate;
+
+	//Without a cache there is nothing to revalidate, only events to wait for
+	int revalidate = w->cache != NULL ? config.revalidate : 0;
+
+	for(;;) {
+		int timeout = -1;
+		if(revalidate > 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+			timeout = ms > 0 ? (int)ms : 0;
+		}
+
+		if(w->fd >= 0) {
+			struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+			int ready = poll(&pfd, 1, timeout);
+			if(ready > 0) {
+				ssize_t len = read(w->fd, events, sizeof(events));
+				for(char* p = events; len > 0 && p < events + len; ) {
+					const struct inotify_event* event = (const struct inotify_event*)p;
+					handle_event(w, event);
+					p += sizeof(struct inotify_event) + event->len;
+				}
+				//A steady stream of events must not put revalidation
+				//off forever, so fall through once it is due
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				if(revalidate == 0 || now.tv_sec < next.tv_sec
+				   || (now.tv_sec == next.tv_sec && now.tv_nsec < next.tv_nsec)) {
+					continue;
+				}
+			}
+		} else {
+			sleep(config.revalidate);
+		}
+
+		if(revalidate > 0) {
+			cache_revalidate(w->cache, is_stale);
+			clock_gettime(CLOCK_MONOTONIC, &next);
+			next.tv_sec += config.revalidate;
+		}
+	}
+	return NULL;
+}
+
+int watcher_start(Cache* cache) {
+	if(!config.watch && (config.revalidate == 0 || cache == NULL)) {
+		return 0;
+	}
+
+	Watcher* w = calloc(1, sizeof(Watcher));
+	if(w == NULL) {
+		return -1;
+	}
+	w->cache = cache;
+	w->fd = -1;
+	if(config.watch) {
+		w->fd = inotify_init1(IN_CLOEXEC);
+		if(w->fd < 0) {
+			perror("inotify_init1");
+		} else {
+			watch_tree(w, "");
+		}
+	}
+	if(w->fd < 0 && (config.revalidate == 0 || cache == NULL)) {
+		free(w);
+		return 0;
+	}
+
+	pthread_t tid;
+	if(pthread_create(&tid, NULL, watcher_thread, w) != 0) {
+		if(w->fd >= 0) {
+			close(w->fd);
+		}
+		free(w);
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file Watcher.h
+ * @brief Keeps the cache in step with the files on disk.
+ *
+ * A background thread watches the docroot with inotify and invalidates
+ * the cached encodings of any file that is written, replaced, renamed
+ * or deleted. In case an event is missed (a queue overflow, a network
+ * filesystem, a directory inotify couldn't watch), every cached entry
+ * is also checked against stat() every --revalidate seconds.
+ *
+ * Lookups never wait for the watcher beyond the usual shard lock.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include "Cache.h"
+
+/**
+ * @brief Start the watcher thread for a cache.
+ *
+ * Call after chdir() to the docroot. Does nothing if both --watch and
+ * --revalidate are off. With no cache (NULL), only the negative cache
+ * is kept up to date, which needs --watch.
+ *
+ * @return 0 on success, -1 if the thread could not be started.
+ */
+int watcher_start(Cache* cache);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file WorkDeque.c
+ * @brief A Chase-Lev work-stealing deque.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdlib.h>
+#include "WorkDeque.h"
+
+static WorkBuffer* create_buffer(long capacity) {
+	WorkBuffer* buffer = malloc(sizeof(WorkBuffer) + capacity * sizeof(_Atomic(void*)));
+	if(buffer == NULL) {
+		return NULL;
+	}
+	buffer->mask = capacity - 1;
+	buffer->older = NULL;
+	return buffer;
+}
+
+int work_deque_init(WorkDeque* d, long capacity) {
+	long size = 1;
+	while(size < capacity) {
+		size *= 2;
+	}
+	WorkBuffer* buffer = create_buffer(size);
+	if(buffer == NULL) {
+		return -1;
+	}
+	atomic_init(&d->top, 0);
+	atomic_init(&d->bottom, 0);
+	atomic_init(&d->buffer, buffer);
+	return 0;
+}
+
+void work_deque_destroy(WorkDeque* d) {
+	WorkBuffer* buffer = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+	while(buffer != NULL) {
+		WorkBuffer* older = buffer->older;
+		free(buffer);
+		buffer = older;
+	}
+}
+
+/**
+ * @brief Copy the live items into a buffer twice the size.
+ */
+static WorkBuffer* grow(WorkDeque* d, WorkBuffer* old, long top, long bottom) {
+	WorkBuffer* buffer = create_buffer((old->mask + 1) * 2);
+	if(buffer == NULL) {
+		return NULL;
+	}
+	for(long i = top; i < bottom; i++) {
+		void* item = atomic_load_explicit(&old->items[i & old->mask], memory_order_relaxed);
+		atomic_store_explicit(&buffer->items[i & buffer->mask], item, memory_order_relaxed);
+	}
+	buffer->older = old;
+	atomic_store_explicit(&d->buffer, buffer, memory_order_release);
+	return buffer;
+}
+
+int work_deque_push(WorkDeque* d, void* item) {
+	long bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&d->top, memory_order_acquire);
+	WorkBuffer* buffer = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+	if(bottom - top > buffer->mask) {
+		buffer = grow(d, buffer, top, bottom);
+		if(buffer == NULL) {
+			return -1;
+		}
+	}
+	atomic_store_explicit(&buffer->items[bottom & buffer->mask], item, memory_order_relaxed);
+	//Thieves that see the new bottom must see the item
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+	return 0;
+}
+
+void* work_deque_pop(WorkDeque* d) {
+	long bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	WorkBuffer* buffer = atomic_load_explicit(&d->buffer, memory_order_relaxed);
+	atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+	//Claim the slot before looking at top, or a thief could take it too
+	atomic_thread_fence(memory_order_seq_cst);
+	long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	if(top > bottom) {
+		//empty
+		atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
+	void* item = atomic_load_explicit(&buffer->items[bottom & buffer->mask], memory_order_relaxed);
+	if(top == bottom) {
+		//The last item: race any thief for it
+		if(!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+		                                            memory_order_seq_cst, memory_order_relaxed)) {
+			item = NULL;
+		}
+		atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return item;
+}
+
+void* work_deque_steal(WorkDeque* d) {
+	long top = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if(top >= bottom) {
+		return NULL;
+	}
+	WorkBuffer* buffer = atomic_load_explicit(&d->buffer, memory_order_acquire);
+	void* item = atomic_load_explicit(&buffer->items[top & buffer->mask], memory_order_relaxed);
+	if(!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+	                                            memory_order_seq_cst, memory_order_relaxed)) {
+		//the owner or another thief got it
+		return NULL;
+	}
+	return item;
+}
+
+int work_deque_empty(WorkDeque* d) {
+	long top = atomic_load_explicit(&d->top, memory_order_acquire);
+	long bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	return top >= bottom;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file WorkDeque.h
+ * @brief A Chase-Lev work-stealing deque.
+ *
+ * Each worker owns one. The owner pushes and pops at the bottom, with
+ * no lock and, unless the deque is down to its last item, no atomic
+ * read-modify-write either; any other thread may steal from the top.
+ * The memory orderings follow Lê, Pop, Cohen and Zappa Nardelli,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (2013).
+ *
+ * The buffer grows as needed. Old buffers are kept until the deque is
+ * destroyed, since a thief may still be reading one.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef WORK_DEQUE_H
+#define WORK_DEQUE_H
+
+#include <stdatomic.h>
+
+typedef struct WorkBuffer {
+	long mask;                  // capacity - 1, a power of two
+	struct WorkBuffer* older;   // retired buffers, freed with the deque
+	_Atomic(void*) items[];
+} WorkBuffer;
+
+typedef struct WorkDeque {
+	atomic_long top;            // next to steal
+	atomic_long bottom;         // next free slot
+	_Atomic(WorkBuffer*) buffer;
+} WorkDeque;
+
+/**
+ * @param capacity Initial capacity, rounded up to a power of two.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int work_deque_init(WorkDeque* d, long capacity);
+
+void work_deque_destroy(WorkDeque* d);
+
+/**
+ * @brief Add an item at the bottom. Owner only.
+ *
+ * @return 0 on success, -1 if the buffer could not grow.
+ */
+int work_deque_push(WorkDeque* d, void* item);
+
+/**
+ * @brief Take the most recently pushed item. Owner only.
+ *
+ * @return The item, or NULL if the deque is empty.
+ */
+void* work_deque_pop(WorkDeque* d);
+
+/**
+ * @brief Take the oldest item. Any thread.
+ *
+ * @return The item, or NULL if the deque is empty or another thread
+ *         took it first.
+ */
+void* work_deque_steal(WorkDeque* d);
+
+/**
+ * @brief Might there be anything to steal? Any thread; only a hint.
+ */
+int work_deque_empty(WorkDeque* d);
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file ZeroCopy.c
+ * @brief MSG_ZEROCOPY sends of cached bodies.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include "ZeroCopy.h"
+#include "Http.h"
+#include "Coro.h"
+#include "Timeout.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/**
+ * @struct Lent
+ * @brief What one zerocopy_send_all() has handed the kernel.
+ */
+typedef struct Lent {
+	unsigned int sends;      // zerocopy send()s that took something
+	unsigned int completed;  // of those, the ones reported done
+	int copied;              // the kernel copied anyway, so stop asking
+} Lent;
+
+// Kept open for abandon(), which may be short of descriptors
+static pthread_once_t null_once = PTHREAD_ONCE_INIT;
+static int null_fd = -1;
+
+static void open_null(void) {
+	null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+/**
+ * @brief Read whatever completions are on the error queue.
+ *
+ * Each notification covers a range of sends, numbered from 0 on each
+ * socket in the order they were made.
+ *
+ * @return 1 if there were any, 0 if not, -1 on error.
+ */
+static int reap(int connfd, Lent* lent) {
+	int got = 0;
+	for(;;) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if(recvmsg(connfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN ? got : -1;
+		}
+		for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if(!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+			   && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+				continue;
+			}
+			struct sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cm), sizeof(err));
+			if(err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			lent->completed += err.ee_data - err.ee_info + 1;
+			if(err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				lent->copied = 1;
+			}
+			got = 1;
+		}
+	}
+}
+
+/**
+ * @brief Wait for at least one more completion.
+ *
+ * @return 0 once some arrived, -1 if the connection died first.
+ */
+static int wait_completion(int connfd, Lent* lent) {
+	for(;;) {
+		int r = reap(connfd, lent);
+		if(r != 0) {
+			return r > 0 ? 0 : -1;
+		}
+		//Shut down both ways (by us, or by a timeout) and nothing
+		//reported: what is queued will never be acknowledged
+		struct pollfd pfd = { .fd = connfd, .events = 0 };
+		if(poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLNVAL))) {
+			return -1;
+		}
+		//A completion raises POLLERR, which is always waited for
+		coro_wait(connfd, 0);
+	}
+}
+
+/**
+ * @brief Drop a dead connection the kernel still holds our pages for.
+ *
+ * A reset purges whatever is queued on it, letting the pages go. The
+ * descriptor is pointed at /dev/null rather than closed, so it stays
+ * its owner's to close as usual, and isn't reused meanwhile.
+ */
+static void abandon(int connfd) {
+	struct linger reset = { 1, 0 };
+	setsockopt(connfd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+	pthread_once(&null_once, open_null);
+	dup2(null_fd, connfd);
+}
+
+long zerocopy_send_all(int connfd, const char* buf, long len) {
+	int on = 1;
+	if(setsockopt(connfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+		return send_all(connfd, buf, len);
+	}
+
+	Lent lent = { 0, 0, 0 };
+	long total_sent = 0;
+	int fallback = 0;
+	while(total_sent < len) {
+		if(lent.copied) {
+			fallback = 1;
+			break;
+		}
+		ssize_t sent = send(connfd, buf + total_sent, len - total_sent, MSG_ZEROCOPY | MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if(sent < 0 && errno == EAGAIN) {
+			coro_wait(connfd, POLLOUT);
+			continue;
+		}
+		if(sent < 0 && errno == ENOBUFS) {
+			//Out of room for notifications until we read some
+			if(lent.completed != lent.sends && wait_completion(connfd, &lent) == 0) {
+				continue;
+			}
+			fallback = lent.completed == lent.sends;
+			break;
+		}
+		if(sent <= 0) {
+			break;
+		}
+		total_sent += sent;
+		lent.sends++;
+		connection_progress(connfd, sent);
+		//Keep the queue short, and find out early if it's copying
+		reap(connfd, &lent);
+	}
+	if(fallback) {
+		total_sent += send_all(connfd, buf + total_sent, len - total_sent);
+	}
+
+	//The pages are the caller's again only once every send is reported
+	while(lent.completed != lent.sends) {
+		if(wait_completion(connfd, &lent) < 0) {
+			abandon(connfd);
+			break;
+		}
+	}
+	return total_sent;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file ZeroCopy.h
+ * @brief MSG_ZEROCOPY sends of cached bodies.
+ *
+ * A zerocopy send pins the body's pages and hands them to the socket
+ * instead of copying them into its buffer. Until the kernel reports on
+ * the socket's error queue that it is done with them, the memory must
+ * not change, so zerocopy_send_all() doesn't return before then: the
+ * caller's reference to the cache entry is what keeps eviction from
+ * freeing it, and it is only put down after we return.
+ *
+ * The price is that the sender waits for the client to acknowledge the
+ * tail of the body, rather than only for it to fit in the socket
+ * buffer. On a coroutine that wait costs nothing; on a thread, it
+ * must not be made with a lock held that other requests need.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#ifndef ZERO_COPY_H
+#define ZERO_COPY_H
+
+/**
+ * @brief Send all of buf without copying it, if the socket allows.
+ *
+ * Falls back to an ordinary send for whatever the kernel won't take
+ * that way (e.g. over loopback, where it would copy anyway). If the
+ * connection dies with the kernel still holding the pages, it is
+ * reset and its descriptor pointed at /dev/null, so the pages are let
+ * go before we return; closing the descriptor is still the caller's
+ * job.
+ *
+ * @return The number of bytes sent, which is less than len on error.
+ */
+long zerocopy_send_all(int connfd, const char* buf, long len);
+
+#endif
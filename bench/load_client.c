@@ -0,0 +1,301 @@
+/**
+ * @file load_client.c
+ * @brief A closed-loop HTTP load generator for the benchmark suite.
+ *
+ * Spawns a fixed number of client threads, each of which repeatedly
+ * connects, sends a GET for a file chosen from the corpus list and
+ * reads the response until the server closes the connection. A request
+ * targets the "hot" set (the first -k files of the list) with
+ * probability -r, otherwise one of the remaining "cold" files, which
+ * lets us control the hit ratio seen by the cached servers.
+ *
+ * When done, a single CSV line is printed to stdout:
+ * requests,errors,seconds,req_per_s,mb_per_s,p50_ms,p90_ms,p99_ms,max_ms
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define MAX_PATH_LEN 1024
+
+/**
+ * @struct Worker
+ * @brief Per-thread state and results for one client thread.
+ */
+typedef struct Worker {
+	pthread_t tid;
+	unsigned int seed;
+	long requests;
+	long errors;
+	long long bytes;
+	double* latencies; // milliseconds, one per successful request
+	long latency_count;
+	long latency_cap;
+} Worker;
+
+static struct sockaddr_in server_addr;
+static char** paths;
+static int path_count;
+static int hot_count = 5;
+static double hit_ratio = 0.8;
+static double duration = 5.0;
+static long per_thread_requests = 0; // 0 means run for `duration` seconds
+
+static struct timespec bench_start;
+
+static double elapsed_since(struct timespec* t) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Pick the next path according to the configured hit ratio.
+ *
+ * @param w The worker whose random seed is used.
+ * @return A path from the corpus list.
+ */
+static const char* pick_path(Worker* w) {
+	int hot = hot_count < path_count ? hot_count : path_count;
+	double r = (double)rand_r(&w->seed) / RAND_MAX;
+	if(hot == path_count || (hot > 0 && r < hit_ratio)) {
+		return paths[rand_r(&w->seed) % hot];
+	}
+	return paths[hot + rand_r(&w->seed) % (path_count - hot)];
+}
+
+/**
+ * @brief Issue a single GET and drain the response.
+ *
+ * @param path The path to request, without the leading slash.
+ * @return The number of bytes received, or -1 on error.
+ */
+static long long do_request(const char* path) {
+	char buffer[64 * 1024];
+	int fd = socket(PF_INET, SOCK_STREAM, 0);
+	if(fd < 0) {
+		return -1;
+	}
+	if(connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	int len = snprintf(buffer, sizeof(buffer), "GET /%s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+	int sent = 0;
+	while(sent < len) {
+		int n = send(fd, buffer + sent, len - sent, 0);
+		if(n <= 0) {
+			close(fd);
+			return -1;
+		}
+		sent += n;
+	}
+
+	long long total = 0;
+	int first = 1;
+	for(;;) {
+		ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		if(first && (n < 12 || strncmp(buffer + 9, "200", 3) != 0)) {
+			total = -1;
+		}
+		first = 0;
+		if(total >= 0) {
+			total += n;
+		}
+	}
+	close(fd);
+	return first ? -1 : total;
+}
+
+static void record(Worker* w, double ms) {
+	if(w->latency_count == w->latency_cap) {
+		w->latency_cap = w->latency_cap ? w->latency_cap * 2 : 4096;
+		w->latencies = realloc(w->latencies, w->latency_cap * sizeof(double));
+		if(w->latencies == NULL) {
+			perror("could not allocate latency samples");
+			exit(EXIT_FAILURE);
+		}
+	}
+	w->latencies[w->latency_count++] = ms;
+}
+
+static void* client_thread(void* args) {
+	Worker* w = args;
+	for(;;) {
+		if(per_thread_requests > 0 ? w->requests + w->errors >= per_thread_requests
+		                           : elapsed_since(&bench_start) >= duration) {
+			break;
+		}
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		long long got = do_request(pick_path(w));
+		if(got < 0) {
+			w->errors++;
+			continue;
+		}
+		w->requests++;
+		w->bytes += got;
+		record(w, elapsed_since(&start) * 1000.0);
+	}
+	return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile(double* sorted, long n, double p) {
+	if(n == 0) return 0.0;
+	long idx = (long)(p * (n - 1) + 0.5);
+	return sorted[idx];
+}
+
+/**
+ * @brief Read the newline-separated corpus list.
+ */
+static void load_paths(const char* list) {
+	FILE* f = fopen(list, "r");
+	if(f == NULL) {
+		perror("fopen");
+		exit(EXIT_FAILURE);
+	}
+	char line[MAX_PATH_LEN];
+	int cap = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] == '\0') continue;
+		if(path_count == cap) {
+			cap = cap ? cap * 2 : 64;
+			paths = realloc(paths, cap * sizeof(char*));
+			if(paths == NULL) {
+				perror("could not allocate path list");
+				exit(EXIT_FAILURE);
+			}
+		}
+		paths[path_count++] = strdup(line[0] == '/' ? line + 1 : line);
+	}
+	fclose(f);
+	if(path_count == 0) {
+		fprintf(stderr, "%s: no paths\n", list);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void usage(const char* prog) {
+	fprintf(stderr,
+		"usage: %s -p port -f list [-a addr] [-c conns] [-d seconds | -n requests]\n"
+		"          [-r hit_ratio] [-k hot_count] [-H]\n"
+		"  -H  print the CSV header line and exit\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+	const char* addr = "127.0.0.1";
+	const char* list = NULL;
+	int port = 0;
+	int concurrency = 1;
+	long total_requests = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "a:p:f:c:d:n:r:k:H")) != -1) {
+		switch(opt) {
+		case 'a': addr = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'f': list = optarg; break;
+		case 'c': concurrency = atoi(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'n': total_requests = atol(optarg); break;
+		case 'r': hit_ratio = atof(optarg); break;
+		case 'k': hot_count = atoi(optarg); break;
+		case 'H':
+			printf("requests,errors,seconds,req_per_s,mb_per_s,p50_ms,p90_ms,p99_ms,max_ms\n");
+			return 0;
+		default: usage(argv[0]);
+		}
+	}
+	if(port <= 0 || list == NULL || concurrency <= 0) {
+		usage(argv[0]);
+	}
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, addr, &server_addr.sin_addr) != 1) {
+		fprintf(stderr, "bad address %s\n", addr);
+		exit(EXIT_FAILURE);
+	}
+	load_paths(list);
+	if(total_requests > 0) {
+		per_thread_requests = (total_requests + concurrency - 1) / concurrency;
+	}
+
+	Worker* workers = calloc(concurrency, sizeof(Worker));
+	if(workers == NULL) {
+		perror("could not allocate workers");
+		exit(EXIT_FAILURE);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &bench_start);
+	for(int i = 0; i < concurrency; i++) {
+		workers[i].seed = 0x9e3779b9u * (i + 1);
+		if(pthread_create(&workers[i].tid, NULL, client_thread, &workers[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	long requests = 0, errors = 0, samples = 0;
+	long long bytes = 0;
+	for(int i = 0; i < concurrency; i++) {
+		pthread_join(workers[i].tid, NULL);
+		requests += workers[i].requests;
+		errors += workers[i].errors;
+		bytes += workers[i].bytes;
+		samples += workers[i].latency_count;
+	}
+	double seconds = elapsed_since(&bench_start);
+
+	double* all = malloc((samples ? samples : 1) * sizeof(double));
+	if(all == NULL) {
+		perror("could not allocate latency samples");
+		exit(EXIT_FAILURE);
+	}
+	long at = 0;
+	for(int i = 0; i < concurrency; i++) {
+		memcpy(all + at, workers[i].latencies, workers[i].latency_count * sizeof(double));
+		at += workers[i].latency_count;
+		free(workers[i].latencies);
+	}
+	qsort(all, samples, sizeof(double), compare_double);
+
+	printf("%ld,%ld,%.3f,%.1f,%.2f,%.3f,%.3f,%.3f,%.3f\n",
+		requests, errors, seconds,
+		requests / seconds,
+		bytes / seconds / (1024.0 * 1024.0),
+		percentile(all, samples, 0.50),
+		percentile(all, samples, 0.90),
+		percentile(all, samples, 0.99),
+		samples ? all[samples - 1] : 0.0);
+
+	free(all);
+	free(workers);
+	return errors > 0 && requests == 0 ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# Four-way server benchmark.
+#
+# Generates a corpus of files, starts each server on an ephemeral port
+# inside the corpus directory and drives it with bench/load_client under
+# every combination of concurrency level and hit ratio. Results are
+# written as CSV and Markdown to $OUT (default bench/results).
+#
+# Everything is configurable through the environment:
+#
+#   SERVERS      servers to run                (server_proc server_thread server_cached server_cached_naive)
+#                an entry may carry its own flags after a colon, comma separated,
+#                e.g. "httpd:--model=epoll,--cache=sharded"
+#   CONCURRENCY  client connection counts      (1 8 32)
+#   HIT_RATIOS   fraction of hot-set requests  (0.0 0.5 0.9)
+#   HOT          size of the hot set           (5, the cache size)
+#   DURATION     seconds per run               (5)
+#   CORPUS       size:count pairs              (1024:40 16384:30 262144:20 4194304:10)
+#   CORPUS_DIR   where the corpus lives        (bench/corpus)
+#   OUT          report directory              (bench/results)
+#   SERVER_ARGS  extra flags for every server  (none), e.g. "--cache-entries=20"
+
+set -e
+
+cd "$(dirname "$0")/.."
+ROOT=$(pwd)
+
+SERVERS=${SERVERS:-"server_proc server_thread server_cached server_cached_naive"}
+CONCURRENCY=${CONCURRENCY:-"1 8 32"}
+HIT_RATIOS=${HIT_RATIOS:-"0.0 0.5 0.9"}
+HOT=${HOT:-5}
+DURATION=${DURATION:-5}
+CORPUS=${CORPUS:-"1024:40 16384:30 262144:20 4194304:10"}
+CORPUS_DIR=${CORPUS_DIR:-$ROOT/bench/corpus}
+OUT=${OUT:-$ROOT/bench/results}
+
+CLIENT=$ROOT/bench/load_client
+
+# (Re)generate the corpus if the size distribution changed.
+if [ ! -f "$CORPUS_DIR/.spec" ] || [ "$(cat "$CORPUS_DIR/.spec")" != "$CORPUS" ]; then
+	echo "generating corpus: $CORPUS"
+	rm -rf "$CORPUS_DIR"
+	mkdir -p "$CORPUS_DIR"
+	for pair in $CORPUS; do
+		size=${pair%%:*}
+		count=${pair##*:}
+		i=0
+		while [ $i -lt "$count" ]; do
+			head -c "$size" /dev/urandom > "$CORPUS_DIR/f${size}_$i.bin"
+			i=$((i + 1))
+		done
+	done
+	# A fixed shuffle, so that the hot set (the first $HOT lines) mixes sizes
+	# but stays the same from run to run.
+	(cd "$CORPUS_DIR" && ls *.bin | awk 'BEGIN { srand(42) } { print rand() "\t" $0 }' \
+		| sort -n | cut -f2 > files.txt)
+	echo "$CORPUS" > "$CORPUS_DIR/.spec"
+fi
+
+mkdir -p "$OUT"
+STAMP=$(date +%Y%m%d-%H%M%S)
+CSV=$OUT/bench-$STAMP.csv
+MD=$OUT/bench-$STAMP.md
+
+printf 'server,concurrency,hit_ratio,' > "$CSV"
+"$CLIENT" -H >> "$CSV"
+
+for server in $SERVERS; do
+	log=$(mktemp)
+	bin=${server%%:*}
+	args=
+	case $server in *:*) args=$(echo "${server#*:}" | tr ',' ' ') ;; esac
+	label=$(echo "$server" | tr ',' ' ')
+	(cd "$CORPUS_DIR" && exec "$ROOT/$bin" --port=0 $args $SERVER_ARGS > "$log" 2> /dev/null) &
+	pid=$!
+
+	port=
+	tries=0
+	while [ -z "$port" ] && [ $tries -lt 50 ]; do
+		sleep 0.1
+		port=$(sed -n 's/^Listening on port \([0-9]*\).*/\1/p' "$log")
+		tries=$((tries + 1))
+	done
+	if [ -z "$port" ]; then
+		echo "$label did not start" >&2
+		kill $pid 2> /dev/null || true
+		rm -f "$log"
+		exit 1
+	fi
+
+	for c in $CONCURRENCY; do
+		for r in $HIT_RATIOS; do
+			printf '%-20s c=%-4s hit=%-4s ' "$label" "$c" "$r"
+			line=$("$CLIENT" -p "$port" -f "$CORPUS_DIR/files.txt" -c "$c" -d "$DURATION" -r "$r" -k "$HOT")
+			echo "$line"
+			echo "$label,$c,$r,$line" >> "$CSV"
+		done
+	done
+
+	kill $pid 2> /dev/null || true
+	wait $pid 2> /dev/null || true
+	rm -f "$log"
+done
+
+awk -F, -v corpus="$CORPUS" -v duration="$DURATION" '
+NR == 1 {
+	print "# Server benchmark\n"
+	print "Corpus: `" corpus "`, " duration " s per run.\n"
+	print "| server | conc | hit | req/s | MB/s | p50 ms | p90 ms | p99 ms | max ms | errors |"
+	print "|---|---:|---:|---:|---:|---:|---:|---:|---:|---:|"
+	next
+}
+{ printf "| %s | %s | %s | %s | %s | %s | %s | %s | %s | %s |\n", $1, $2, $3, $7, $8, $9, $10, $11, $12, $5 }
+' "$CSV" > "$MD"
+
+echo
+cat "$MD"
+echo
+echo "wrote $CSV and $MD"
@@ -0,0 +1,22 @@
+/**
+ * @file httpd.c
+ * @brief The HTTP server, with the concurrency model and cache picked at runtime.
+ *
+ * Defaults to a thread pool with the reference-counted deque cache.
+ * See `httpd --help` for --model and --cache.
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+#include <stddef.h>
+#include "Server.h"
+
+int main(int argc, char** argv)
+{
+	static const char* presets[][2] = {
+		{ "model", "pool" },
+		{ "cache", "deque" },
+		{ NULL, NULL }
+	};
+	return server_main(argc, argv, "stats_httpd.txt", presets);
+}
@@ -0,0 +1,134 @@
+/**
+ * @file mkmime.c
+ * @brief Build-time generator of the perfect hash table in MimeTable.h.
+ *
+ * Reads mime.types and searches for a seed of mime_hash() under which
+ * every extension lands in its own slot, trying ever larger tables
+ * until one works. The table is written to stdout:
+ *
+ *     tools/mkmime mime.types > MimeTable.h
+ *
+ * @author Joshua Hellauer
+ * @date 2024-11-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../Mime.h"
+
+#define MAX_ENTRIES 4096
+#define SEED_TRIES 1000000
+
+typedef struct Entry {
+	char ext[MIME_EXT_MAX];
+	char type[128];
+} Entry;
+
+static Entry entries[MAX_ENTRIES];
+static int count;
+
+static void read_types(const char* path) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[1024];
+	int lineno = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		char* hash = strchr(line, '#');
+		if(hash != NULL) {
+			*hash = '\0';
+		}
+		char* type = strtok(line, " \t\r\n");
+		if(type == NULL) {
+			continue;
+		}
+		if(strlen(type) >= sizeof(entries[0].type)) {
+			fprintf(stderr, "%s:%d: type too long\n", path, lineno);
+			exit(EXIT_FAILURE);
+		}
+		char* ext;
+		while((ext = strtok(NULL, " \t\r\n")) != NULL) {
+			if(strlen(ext) >= MIME_EXT_MAX || count == MAX_ENTRIES) {
+				fprintf(stderr, "%s:%d: extension '%s' too long, or too many\n", path, lineno, ext);
+				exit(EXIT_FAILURE);
+			}
+			for(char* c = ext; *c; c++) {
+				*c = tolower((unsigned char)*c);
+			}
+			for(int i = 0; i < count; i++) {
+				if(strcmp(entries[i].ext, ext) == 0) {
+					fprintf(stderr, "%s:%d: extension '%s' listed twice\n", path, lineno, ext);
+					exit(EXIT_FAILURE);
+				}
+			}
+			strcpy(entries[count].ext, ext);
+			strcpy(entries[count].type, type);
+			count++;
+		}
+	}
+	fclose(f);
+}
+
+/**
+ * @brief Does every extension get its own slot?
+ *
+ * @param slots Filled in with the entry in each slot, or -1.
+ */
+static int try_seed(unsigned long seed, unsigned long size, int* slots) {
+	for(unsigned long i = 0; i < size; i++) {
+		slots[i] = -1;
+	}
+	for(int i = 0; i < count; i++) {
+		unsigned long slot = mime_hash(seed, entries[i].ext, strlen(entries[i].ext)) & (size - 1);
+		if(slots[slot] >= 0) {
+			return 0;
+		}
+		slots[slot] = i;
+	}
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if(argc != 2) {
+		fprintf(stderr, "usage: %s mime.types > MimeTable.h\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	read_types(argv[1]);
+
+	unsigned long size = 1;
+	while(size < (unsigned long)count * 2) {
+		size *= 2;
+	}
+	for(;; size *= 2) {
+		int* slots = malloc(size * sizeof(int));
+		if(slots == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		for(unsigned long seed = 0; seed < SEED_TRIES; seed++) {
+			if(!try_seed(seed, size, slots)) {
+				continue;
+			}
+
+			printf("/* Generated by tools/mkmime from %s. Do not edit. */\n\n", argv[1]);
+			printf("#define MIME_TABLE_SEED %luUL\n", seed);
+			printf("#define MIME_TABLE_SIZE %lu\n\n", size);
+			printf("static const struct { const char* ext; const char* type; } mime_table[MIME_TABLE_SIZE] = {\n");
+			for(unsigned long i = 0; i < size; i++) {
+				if(slots[i] >= 0) {
+					printf("\t[%lu] = { \"%s\", \"%s\" },\n", i, entries[slots[i]].ext, entries[slots[i]].type);
+				}
+			}
+			printf("};\n");
+			free(slots);
+			return 0;
+		}
+		free(slots);
+	}
+}